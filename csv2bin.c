@@ -0,0 +1,50 @@
+/** @file csv2bin.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libtrace/libtrace.h"
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+		fprintf(stderr, "       %s examples/proc1.csv proc1.bin\n", argv[0]);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Converts a CSV trace (or - for stdin) to the binary trace format.\n");
+		return 1;
+	}
+
+	trace_t trace;
+	switch (trace_load(&trace, argv[1]))
+	{
+		case TRACE_OK:
+			break;
+
+		case TRACE_ERR_OPEN:
+			fprintf(stderr, "Unable to open file \"%s\".\n", argv[1]);
+			return 2;
+
+		case TRACE_ERR_FORMAT:
+			fprintf(stderr, "Illegal file format.\n");
+			return 2;
+
+		default:
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
+	}
+
+	if (trace_save_binary(&trace, argv[2]) != TRACE_OK)
+	{
+		fprintf(stderr, "Unable to write file \"%s\".\n", argv[2]);
+		trace_free(&trace);
+		return 2;
+	}
+
+	printf("Wrote %d job(s) to %s.\n", trace.num_jobs, argv[2]);
+	trace_free(&trace);
+
+	return 0;
+}
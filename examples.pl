@@ -3,16 +3,28 @@
 # EECS678
 # Adopted from CS 241 @ The University of Illinois
 
+# Every example is run with the trace loaded and again streamed (-l).  The
+# two agree unless several jobs finish or arrive in the same time unit:
+# streaming breaks those ties by arrival time, then job_id, instead of by
+# jobs-array slot (see simulator.c), so its times can differ.  The examples
+# where such a tie changes the outcome are only run loaded.
+%slot_ties = map { $_ => 1 } qw(proc3-c2-pri proc3-c2-rr2 proc3-c2-rr4 proc3-c4-sjf proc3-c4-pri proc3-c4-ppri proc3-c4-rr4);
+
 for $file (<examples/*>){
-	if( $file =~ /proc(\d+)-c(\d+)-(\w+)\.out/){
-	#	print "Proc $1 CORE $2 Proc $3\n";
-		`./simulator -c $2 -s $3 examples/proc$1.csv | tail -7 > output1`;
-		`tail -7 $file > output2`;
-		$diff = `diff output1 output2`;
-		if($diff){
-			print "Test file $file differs\n$diff";
+	if( $file =~ /(proc(\d+)-c(\d+)-(\w+))\.out/){
+	#	print "Proc $2 CORE $3 Proc $4\n";
+		for $mode ("", "-l"){
+			next if $mode && $slot_ties{$1};
+			`./simulator $mode -c $3 -s $4 examples/proc$2.csv | tail -7 > output1`;
+			`tail -7 $file > output2`;
+			$diff = `diff output1 output2`;
+			if($diff){
+				print "Test file $file differs" . ($mode ? " with $mode" : "") . "\n$diff";
+				$failed = 1;
+			}
 		}
 	}
 }
 #cleanup
 `rm output1 output2`;
+exit($failed ? 1 : 0);
@@ -6,13 +6,457 @@
 
 #include "libpriqueue.h"
 
+#ifdef SCHED_STATS
+#define PRIQUEUE_STAT(q, counter) ((q)->stats.counter++)
+#else
+#define PRIQUEUE_STAT(q, counter) ((void)0)
+#endif
+
 node* newNode() {
 	node* ptr = (node*) malloc (sizeof(node));
 	ptr->data = NULL;
 	ptr->nextNode = NULL;
+	ptr->seq = 0;
+	ptr->index = -1;
+	ptr->child[0] = ptr->child[1] = ptr->parent = NULL;
+	ptr->red = 0;
+	return ptr;
+}
+
+/**
+  Initializes a node pool.
+
+  @param pool a pointer to an instance of the priqueue_pool_t data structure
+  @param capacity the number of nodes to preallocate, or 0 to allocate on demand
+ */
+void priqueue_pool_init(priqueue_pool_t *pool, int capacity)
+{
+	pool->freeList = NULL;
+	pool->slabs = NULL;
+	pool->nextSlab = capacity > 0 ? capacity : 64;
+	if (capacity > 0) {
+		priqueue_pool_put(pool, priqueue_pool_get(pool));
+	}
+}
+
+/**
+  Hands out a node from the pool, carving a new slab when the free list is empty.
+
+  @param pool a pointer to an instance of the priqueue_pool_t data structure
+  @return a node with its fields reset
+ */
+node* priqueue_pool_get(priqueue_pool_t *pool)
+{
+	if (pool->freeList == NULL) {
+		int count = pool->nextSlab;
+		priqueue_slab_t* slab = (priqueue_slab_t*) malloc(sizeof(priqueue_slab_t) + sizeof(node) * count);
+		slab->count = count;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+
+		for (int i = count - 1; i >= 0; i--) {
+			slab->nodes[i].nextNode = pool->freeList;
+			pool->freeList = &slab->nodes[i];
+		}
+
+		//Grow geometrically, but keep single slabs a reasonable size
+		if (pool->nextSlab < 4096) {
+			pool->nextSlab *= 2;
+		}
+	}
+
+	node* ptr = pool->freeList;
+	pool->freeList = ptr->nextNode;
+	ptr->data = NULL;
+	ptr->nextNode = NULL;
+	ptr->seq = 0;
+	ptr->index = -1;
+	ptr->child[0] = ptr->child[1] = ptr->parent = NULL;
+	ptr->red = 0;
 	return ptr;
 }
 
+/**
+  Returns a node to the pool's free list.
+
+  @param pool a pointer to an instance of the priqueue_pool_t data structure
+  @param n the node to recycle
+ */
+void priqueue_pool_put(priqueue_pool_t *pool, node *n)
+{
+	n->nextNode = pool->freeList;
+	pool->freeList = n;
+}
+
+/**
+  Releases every slab owned by the pool. Any node handed out is invalid afterwards.
+
+  @param pool a pointer to an instance of the priqueue_pool_t data structure
+ */
+void priqueue_pool_destroy(priqueue_pool_t *pool)
+{
+	while (pool->slabs != NULL) {
+		priqueue_slab_t* slab = pool->slabs;
+		pool->slabs = slab->next;
+		free(slab);
+	}
+	pool->freeList = NULL;
+}
+
+/*
+ * Binary heap helpers.
+ *
+ * The heap stores node pointers so the ordering can fall back on the
+ * insertion sequence number when the comparer reports a tie. That keeps
+ * the heap FIFO-stable, matching the order the sorted list produces.
+ */
+
+//Runs whichever comparer the queue was initialized with
+static int compareData(priqueue_t *q, const void* a, const void* b)
+{
+	PRIQUEUE_STAT(q, comparisons);
+	if (q->compareUser) {
+		return q->compareUser(a, b, q->user);
+	}
+	return q->compare(a, b);
+}
+
+static int heapLess(priqueue_t *q, node* a, node* b)
+{
+	int cmp = compareData(q, a->data, b->data);
+	if (cmp != 0) {
+		return cmp < 0;
+	}
+	return a->seq < b->seq;
+}
+
+static int heapSiftUp(priqueue_t *q, node** heap, int index)
+{
+	node* moving = heap[index];
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+		if (!heapLess(q, moving, heap[parent])) {
+			break;
+		}
+		heap[index] = heap[parent];
+		heap[index]->index = index;
+		index = parent;
+		PRIQUEUE_STAT(q, traversed);
+	}
+	heap[index] = moving;
+	moving->index = index;
+	return index;
+}
+
+static int heapSiftDown(priqueue_t *q, node** heap, int size, int index)
+{
+	node* moving = heap[index];
+	for (;;) {
+		int child = 2 * index + 1;
+		if (child >= size) {
+			break;
+		}
+		if (child + 1 < size && heapLess(q, heap[child + 1], heap[child])) {
+			child++;
+		}
+		if (!heapLess(q, heap[child], moving)) {
+			break;
+		}
+		heap[index] = heap[child];
+		heap[index]->index = index;
+		index = child;
+	}
+	heap[index] = moving;
+	moving->index = index;
+	return index;
+}
+
+//Removes the node stored at heap slot index and restores the heap property
+static node* heapRemoveSlot(priqueue_t *q, node** heap, int* size, int index)
+{
+	node* removed = heap[index];
+	(*size)--;
+	if (index != *size) {
+		heap[index] = heap[*size];
+		if (heapSiftDown(q, heap, *size, index) == index) {
+			heapSiftUp(q, heap, index);
+		}
+	}
+	return removed;
+}
+
+//Drops the sorted view of the heap; every change to its elements or their order calls this
+static void heapOrderStale(priqueue_t *q)
+{
+	q->nOrdered = -1;
+}
+
+//Finds the heap slot holding the index'th element in priority order. The
+//whole order is worked out once, in O(n log n), and reused until the heap
+//changes, so walking an unchanged heap with priqueue_at() costs O(n) in all.
+static int heapSlotAt(priqueue_t *q, int index)
+{
+	if (index == 0) {
+		return 0;
+	}
+
+	if (q->nOrdered != q->size) {
+		//Pop everything off a scratch copy, in order
+		node** scratch = (node**) malloc(sizeof(node*) * q->size);
+		int size = q->size;
+		for (int i = 0; i < size; i++) {
+			scratch[i] = q->slots[i];
+		}
+		q->ordered = (node**) realloc(q->ordered, sizeof(node*) * q->size);
+		for (int i = 0; i < q->size; i++) {
+			q->ordered[i] = heapRemoveSlot(q, scratch, &size, 0);
+		}
+		free(scratch);
+		q->nOrdered = q->size;
+
+		//The scratch pops moved the nodes' slot bookkeeping; put it back
+		for (int i = 0; i < q->size; i++) {
+			q->slots[i]->index = i;
+		}
+	}
+	return q->ordered[index]->index;
+}
+
+/*
+ * Ring buffer helpers for the FIFO backend. Element i lives at
+ * slots[(first + i) % capacity], and each node remembers its slot.
+ */
+
+static int fifoSlot(priqueue_t *q, int index)
+{
+	int slot = q->first + index;
+	if (slot >= q->capacity) {
+		slot -= q->capacity;
+	}
+	return slot;
+}
+
+static void fifoGrow(priqueue_t *q)
+{
+	int capacity = q->capacity ? q->capacity * 2 : 16;
+	node** slots = (node**) malloc(sizeof(node*) * capacity);
+	for (int i = 0; i < q->size; i++) {
+		slots[i] = q->slots[fifoSlot(q, i)];
+		slots[i]->index = i;
+	}
+	free(q->slots);
+	q->slots = slots;
+	q->capacity = capacity;
+	q->first = 0;
+}
+
+static void fifoMove(priqueue_t *q, int from, int to)
+{
+	int slot = fifoSlot(q, to);
+	q->slots[slot] = q->slots[fifoSlot(q, from)];
+	q->slots[slot]->index = slot;
+}
+
+//Removes element index, closing the gap from whichever end of the ring is nearer
+static node* fifoRemoveIndex(priqueue_t *q, int index)
+{
+	node* removed = q->slots[fifoSlot(q, index)];
+	if (index < q->size / 2) {
+		for (int i = index; i > 0; i--) {
+			fifoMove(q, i - 1, i);
+		}
+		q->first = fifoSlot(q, 1);
+	} else {
+		for (int i = index; i < q->size - 1; i++) {
+			fifoMove(q, i + 1, i);
+		}
+	}
+	q->size--;
+	return removed;
+}
+
+/*
+ * Red-black tree helpers for the tree backend. The root lives in head,
+ * nodes are ordered like the heap (comparer, then insertion sequence), and
+ * leftmost caches the first node so peek and poll do not walk down to it.
+ * Nodes are relinked rather than having their data swapped, so handles
+ * stay valid across every rebalance.
+ */
+
+static int treeIsRed(node* n)
+{
+	return n != NULL && n->red;
+}
+
+//Points whatever referred to old (its parent or the root) at replacement
+static void treeReplace(priqueue_t *q, node* old, node* replacement)
+{
+	if (old->parent == NULL) {
+		q->head = replacement;
+	} else {
+		old->parent->child[old == old->parent->child[1]] = replacement;
+	}
+	if (replacement != NULL) {
+		replacement->parent = old->parent;
+	}
+}
+
+//Rotates x down towards side dir (0 is a left rotation)
+static void treeRotate(priqueue_t *q, node* x, int dir)
+{
+	node* y = x->child[1 - dir];
+	x->child[1 - dir] = y->child[dir];
+	if (y->child[dir] != NULL) {
+		y->child[dir]->parent = x;
+	}
+	treeReplace(q, x, y);
+	y->child[dir] = x;
+	x->parent = y;
+}
+
+static node* treeFirst(node* n)
+{
+	while (n->child[0] != NULL) {
+		n = n->child[0];
+	}
+	return n;
+}
+
+//The node after n in order, or NULL at the end
+static node* treeNext(node* n)
+{
+	if (n->child[1] != NULL) {
+		return treeFirst(n->child[1]);
+	}
+	while (n->parent != NULL && n == n->parent->child[1]) {
+		n = n->parent;
+	}
+	return n->parent;
+}
+
+//Links n into the tree by its data and seq. Returns 1 if it became the leftmost node.
+static int treeInsert(priqueue_t *q, node* n)
+{
+	node* parent = NULL;
+	node** link = &q->head;
+	int leftmost = 1;
+	while (*link != NULL) {
+		parent = *link;
+		int right = !heapLess(q, n, parent);
+		leftmost &= !right;
+		link = &parent->child[right];
+		PRIQUEUE_STAT(q, traversed);
+	}
+	n->parent = parent;
+	n->child[0] = n->child[1] = NULL;
+	n->red = 1;
+	*link = n;
+	if (leftmost) {
+		q->leftmost = n;
+	}
+	q->size++;
+
+	while ((parent = n->parent) != NULL && parent->red) {
+		node* grand = parent->parent;
+		int side = (parent == grand->child[1]);
+		node* uncle = grand->child[1 - side];
+		if (treeIsRed(uncle)) {
+			parent->red = uncle->red = 0;
+			grand->red = 1;
+			n = grand;
+			continue;
+		}
+		if (n == parent->child[1 - side]) {
+			treeRotate(q, parent, side);
+			n = parent;
+			parent = n->parent;
+		}
+		parent->red = 0;
+		grand->red = 1;
+		treeRotate(q, grand, 1 - side);
+	}
+	q->head->red = 0;
+	return leftmost;
+}
+
+//Unlinks z from the tree and rebalances
+static void treeErase(priqueue_t *q, node* z)
+{
+	if (q->leftmost == z) {
+		q->leftmost = treeNext(z);
+	}
+
+	node* child;
+	node* parent;
+	int removedRed = z->red;
+	if (z->child[0] == NULL || z->child[1] == NULL) {
+		child = z->child[z->child[0] == NULL];
+		parent = z->parent;
+		treeReplace(q, z, child);
+	} else {
+		//z has two children: its successor y takes its place and colour
+		node* y = treeFirst(z->child[1]);
+		removedRed = y->red;
+		child = y->child[1];
+		if (y->parent == z) {
+			parent = y;
+		} else {
+			parent = y->parent;
+			treeReplace(q, y, child);
+			y->child[1] = z->child[1];
+			y->child[1]->parent = y;
+		}
+		treeReplace(q, z, y);
+		y->child[0] = z->child[0];
+		y->child[0]->parent = y;
+		y->red = z->red;
+	}
+	q->size--;
+
+	//Removing a black node leaves child's side one black short
+	while (!removedRed && child != q->head && !treeIsRed(child)) {
+		int side = (child == parent->child[1]);
+		node* sibling = parent->child[1 - side];
+		if (sibling->red) {
+			sibling->red = 0;
+			parent->red = 1;
+			treeRotate(q, parent, side);
+			sibling = parent->child[1 - side];
+		}
+		if (!treeIsRed(sibling->child[0]) && !treeIsRed(sibling->child[1])) {
+			sibling->red = 1;
+			child = parent;
+			parent = child->parent;
+			continue;
+		}
+		if (!treeIsRed(sibling->child[1 - side])) {
+			sibling->child[side]->red = 0;
+			sibling->red = 1;
+			treeRotate(q, sibling, 1 - side);
+			sibling = parent->child[1 - side];
+		}
+		sibling->red = parent->red;
+		parent->red = 0;
+		sibling->child[1 - side]->red = 0;
+		treeRotate(q, parent, side);
+		child = q->head;
+	}
+	if (child != NULL && !removedRed) {
+		child->red = 0;
+	}
+	z->child[0] = z->child[1] = z->parent = NULL;
+}
+
+//Finds the index'th node in order by walking from the leftmost one
+static node* treeAt(priqueue_t *q, int index)
+{
+	node* n = q->leftmost;
+	for (int i = 0; i < index; i++) {
+		n = treeNext(n);
+	}
+	return n;
+}
+
 /**
   Initializes the priqueue_t data structure.
 
@@ -24,23 +468,105 @@ node* newNode() {
   See also @ref comparer-page
  */
 void priqueue_init(priqueue_t *q, int(*comparer)(const void *, const void *))
+{
+	priqueue_init_attr(q, comparer, NULL);
+}
+
+
+/**
+  Initializes the priqueue_t data structure with the given options.
+
+  The same assumptions as priqueue_init() apply.
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param comparer a function pointer that compares two elements.
+  @param attr the options to build the queue with, or NULL for the defaults
+ */
+void priqueue_init_attr(priqueue_t *q, int(*comparer)(const void *, const void *), const priqueue_attr_t *attr)
 {
 	q->head = NULL;
 	q->size = 0;
 	q->compare = comparer;
+	q->compareUser = NULL;
+	q->user = NULL;
+	q->backend = attr ? attr->backend : PRIQUEUE_LIST;
+	q->slots = NULL;
+	q->capacity = 0;
+	q->first = 0;
+	q->seq = 0;
+	q->stats = (priqueue_stats_t) { 0, 0, 0 };
+	q->leftmost = NULL;
+	q->ordered = NULL;
+	q->nOrdered = -1;
+
+	int capacity = attr ? attr->capacity : 0;
+	if (attr && attr->pool) {
+		q->pool = attr->pool;
+	} else {
+		priqueue_pool_init(&q->ownPool, capacity);
+		q->pool = &q->ownPool;
+	}
+
+	if ((q->backend == PRIQUEUE_HEAP || q->backend == PRIQUEUE_FIFO) && capacity > 0) {
+		q->capacity = capacity;
+		q->slots = (node**) malloc(sizeof(node*) * capacity);
+	}
 }
 
 /**
-  Inserts the specified element into this priority queue.
+  Initializes the priqueue_t data structure with a comparer that also gets
+  a caller-supplied pointer, so it can read per-instance state instead of
+  globals.
 
+  The same assumptions as priqueue_init() apply.
   @param q a pointer to an instance of the priqueue_t data structure
-  @param ptr a pointer to the data to be inserted into the priority queue
-  @return The zero-based index where ptr is stored in the priority queue, where 0 indicates that ptr was stored at the front of the priority queue.
+  @param comparer a function pointer that compares two elements; its third argument is user.
+  @param user passed unchanged to every call of comparer
+  @param attr the options to build the queue with, or NULL for the defaults
  */
-int priqueue_offer(priqueue_t *q, void *ptr)
+void priqueue_init_user(priqueue_t *q, int(*comparer)(const void *, const void *, void *), void *user, const priqueue_attr_t *attr)
 {
-	node* nNode = newNode();
-	nNode->data = ptr;
+	priqueue_init_attr(q, NULL, attr);
+	q->compareUser = comparer;
+	q->user = user;
+}
+
+//Draws a node for an offer, counting it when the pool has to carve a new slab
+static node* takeNode(priqueue_t *q)
+{
+	if (q->pool->freeList == NULL) {
+		PRIQUEUE_STAT(q, allocations);
+	}
+	return priqueue_pool_get(q->pool);
+}
+
+//Links a node that already carries its data and seq into the queue and returns its index
+static int linkNode(priqueue_t *q, node* nNode)
+{
+	if (q->backend == PRIQUEUE_HEAP) {
+		heapOrderStale(q);
+		if (q->size == q->capacity) {
+			PRIQUEUE_STAT(q, allocations);
+			q->capacity = q->capacity ? q->capacity * 2 : 16;
+			q->slots = (node**) realloc(q->slots, sizeof(node*) * q->capacity);
+		}
+		q->slots[q->size] = nNode;
+		return heapSiftUp(q, q->slots, q->size++);
+	}
+
+	if (q->backend == PRIQUEUE_TREE) {
+		return treeInsert(q, nNode) ? 0 : 1;
+	}
+
+	if (q->backend == PRIQUEUE_FIFO) {
+		if (q->size == q->capacity) {
+			PRIQUEUE_STAT(q, allocations);
+			fifoGrow(q);
+		}
+		nNode->index = fifoSlot(q, q->size);
+		q->slots[nNode->index] = nNode;
+		return q->size++;
+	}
+
 	//If queue is empty
 	if (q->size == 0) {
 		q->head = nNode;
@@ -48,7 +574,7 @@ int priqueue_offer(priqueue_t *q, void *ptr)
 		return 0;
 	} else { //Else something is in the queue
 		//Element belongs at head
-		if (q->compare(nNode->data, q->head->data) < 0) {
+		if (heapLess(q, nNode, q->head)) {
 			nNode->nextNode = q->head;
 			q->head = nNode;
 			q->size++;
@@ -58,19 +584,64 @@ int priqueue_offer(priqueue_t *q, void *ptr)
 		//Traverse until we find correct spot
 		node* traverse = q->head;
 		for (int i = 0; i < q->size; i++) {
-			if (traverse->nextNode == NULL || q->compare(nNode->data, traverse->nextNode->data) < 0) {
+			if (traverse->nextNode == NULL || heapLess(q, nNode, traverse->nextNode)) {
 				nNode->nextNode = traverse->nextNode;
 				traverse->nextNode = nNode;
 				q->size++;
 				return i+1;
 			} else {
 				traverse = traverse->nextNode;
+				PRIQUEUE_STAT(q, traversed);
 			}
 		}
 	}
 	return -1; //Returns if error
 }
 
+//Links a freshly filled-in node behind everything already queued with an equal key
+static int offerNode(priqueue_t *q, node* nNode)
+{
+	nNode->seq = q->seq++;
+	return linkNode(q, nNode);
+}
+
+/**
+  Inserts the specified element into this priority queue.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param ptr a pointer to the data to be inserted into the priority queue
+  @return The zero-based index where ptr is stored in the priority queue, where 0 indicates that ptr was stored at the front of the priority queue.
+  For PRIQUEUE_HEAP the index is the heap slot, which is 0 only at the front.
+  PRIQUEUE_FIFO never calls the comparer and always stores ptr at the back.
+  PRIQUEUE_TREE returns 0 when ptr went to the front and 1 anywhere else.
+ */
+int priqueue_offer(priqueue_t *q, void *ptr)
+{
+	node* nNode = takeNode(q);
+	nNode->data = ptr;
+	return offerNode(q, nNode);
+}
+
+/**
+  Inserts the specified element and returns a handle to it.
+
+  The handle stays valid until the element leaves the queue through any of
+  the poll/remove functions, and can be passed to priqueue_remove_handle()
+  and priqueue_update_handle().
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param ptr a pointer to the data to be inserted into the priority queue
+  @return a handle to the inserted element
+ */
+priqueue_handle_t priqueue_offer_handle(priqueue_t *q, void *ptr)
+{
+	node* nNode = takeNode(q);
+	nNode->data = ptr;
+	offerNode(q, nNode);
+	return nNode;
+}
+
+
 /**
   Retrieves, but does not remove, the head of this queue, returning NULL if
   this queue is empty.
@@ -81,6 +652,15 @@ int priqueue_offer(priqueue_t *q, void *ptr)
  */
 void *priqueue_peek(priqueue_t *q)
 {
+	if (q->backend == PRIQUEUE_HEAP) {
+		return q->size > 0 ? q->slots[0]->data : NULL;
+	}
+	if (q->backend == PRIQUEUE_FIFO) {
+		return q->size > 0 ? q->slots[q->first]->data : NULL;
+	}
+	if (q->backend == PRIQUEUE_TREE) {
+		return q->size > 0 ? q->leftmost->data : NULL;
+	}
 	if (q->head != NULL) {
 		return (q->head)->data;
 	}
@@ -98,12 +678,43 @@ void *priqueue_peek(priqueue_t *q)
  */
 void *priqueue_poll(priqueue_t *q)
 {
+	if (q->backend == PRIQUEUE_HEAP) {
+		if (q->size == 0) {
+			return NULL;
+		}
+		heapOrderStale(q);
+		node* removeMe = heapRemoveSlot(q, q->slots, &q->size, 0);
+		void* dataToReturn = removeMe->data;
+		priqueue_pool_put(q->pool, removeMe);
+		return dataToReturn;
+	}
+	if (q->backend == PRIQUEUE_FIFO) {
+		if (q->size == 0) {
+			return NULL;
+		}
+		node* removeMe = q->slots[q->first];
+		void* dataToReturn = removeMe->data;
+		q->first = fifoSlot(q, 1);
+		q->size--;
+		priqueue_pool_put(q->pool, removeMe);
+		return dataToReturn;
+	}
+	if (q->backend == PRIQUEUE_TREE) {
+		if (q->size == 0) {
+			return NULL;
+		}
+		node* removeMe = q->leftmost;
+		void* dataToReturn = removeMe->data;
+		treeErase(q, removeMe);
+		priqueue_pool_put(q->pool, removeMe);
+		return dataToReturn;
+	}
 	if (q->head != NULL) {
 		node* removeMe = q->head;
 		void* dataToReturn = removeMe->data;
 		q->head = (q->head)->nextNode;
 		q->size -= 1;
-		free(removeMe);
+		priqueue_pool_put(q->pool, removeMe);
 		return dataToReturn;
 	}
 	return NULL;
@@ -114,6 +725,9 @@ void *priqueue_poll(priqueue_t *q)
   Returns the element at the specified position in this list, or NULL if
   the queue does not contain an index'th element.
 
+  On PRIQUEUE_HEAP the first lookup after the queue changes sorts a copy of
+  the heap, O(n log n), and further lookups reuse it until the next change.
+
   @param q a pointer to an instance of the priqueue_t data structure
   @param index position of retrieved element
   @return the index'th element in the queue
@@ -121,6 +735,24 @@ void *priqueue_poll(priqueue_t *q)
  */
 void *priqueue_at(priqueue_t *q, int index)
 {
+	if (q->backend == PRIQUEUE_HEAP) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		return q->slots[heapSlotAt(q, index)]->data;
+	}
+	if (q->backend == PRIQUEUE_FIFO) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		return q->slots[fifoSlot(q, index)]->data;
+	}
+	if (q->backend == PRIQUEUE_TREE) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		return treeAt(q, index)->data;
+	}
 	if (index < q->size) {
 		node* traverse = q->head;
 		for (int i = 0; i < index; i++) {
@@ -145,10 +777,61 @@ void *priqueue_at(priqueue_t *q, int index)
 int priqueue_remove(priqueue_t *q, void *ptr)
 {
 	int numRemoved = 0;
+	if (q->backend == PRIQUEUE_HEAP) {
+		//Compact out every match, then rebuild the heap bottom-up in O(n)
+		int kept = 0;
+		for (int i = 0; i < q->size; i++) {
+			if (q->slots[i]->data == ptr) {
+				priqueue_pool_put(q->pool, q->slots[i]);
+				numRemoved++;
+			} else {
+				q->slots[kept] = q->slots[i];
+				q->slots[kept]->index = kept;
+				kept++;
+			}
+		}
+		q->size = kept;
+		if (numRemoved > 0) {
+			heapOrderStale(q);
+			for (int i = q->size / 2 - 1; i >= 0; i--) {
+				heapSiftDown(q, q->slots, q->size, i);
+			}
+		}
+		return numRemoved;
+	}
+	if (q->backend == PRIQUEUE_FIFO) {
+		int kept = 0;
+		for (int i = 0; i < q->size; i++) {
+			node* n = q->slots[fifoSlot(q, i)];
+			if (n->data == ptr) {
+				priqueue_pool_put(q->pool, n);
+				numRemoved++;
+			} else {
+				n->index = fifoSlot(q, kept++);
+				q->slots[n->index] = n;
+			}
+		}
+		q->size = kept;
+		return numRemoved;
+	}
+	if (q->backend == PRIQUEUE_TREE) {
+		node* n = q->leftmost;
+		while (n != NULL) {
+			node* next = treeNext(n);
+			if (n->data == ptr) {
+				treeErase(q, n);
+				priqueue_pool_put(q->pool, n);
+				numRemoved++;
+			}
+			n = next;
+		}
+		return numRemoved;
+	}
+
 	while (q->size > 0 && q->head->data == ptr) {
 		node* removeMe = q->head;
 		q->head = q->head->nextNode;
-		free(removeMe);
+		priqueue_pool_put(q->pool, removeMe);
 		q->size--;
 		numRemoved++;
 	}
@@ -163,7 +846,7 @@ int priqueue_remove(priqueue_t *q, void *ptr)
 	while (traverse != NULL) {
 		if (traverse->data == ptr) {
 			prev->nextNode = traverse->nextNode;
-			free(traverse);
+			priqueue_pool_put(q->pool, traverse);
 			q->size--;
 			numRemoved++;
 			traverse = prev->nextNode;
@@ -189,6 +872,36 @@ int priqueue_remove(priqueue_t *q, void *ptr)
  */
 void *priqueue_remove_at(priqueue_t *q, int index)
 {
+	if (q->backend == PRIQUEUE_HEAP) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		int slot = heapSlotAt(q, index);
+		heapOrderStale(q);
+		node* removeMe = heapRemoveSlot(q, q->slots, &q->size, slot);
+		void *data = removeMe->data;
+		priqueue_pool_put(q->pool, removeMe);
+		return data;
+	}
+	if (q->backend == PRIQUEUE_FIFO) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		node* removeMe = fifoRemoveIndex(q, index);
+		void *data = removeMe->data;
+		priqueue_pool_put(q->pool, removeMe);
+		return data;
+	}
+	if (q->backend == PRIQUEUE_TREE) {
+		if (index < 0 || index >= q->size) {
+			return NULL;
+		}
+		node* removeMe = treeAt(q, index);
+		treeErase(q, removeMe);
+		void *data = removeMe->data;
+		priqueue_pool_put(q->pool, removeMe);
+		return data;
+	}
 	if (index < q->size) {
 		node* prev = NULL;
 		node* traverse = q->head;
@@ -198,7 +911,7 @@ void *priqueue_remove_at(priqueue_t *q, int index)
 		}
 		void *data = traverse->data;
 		prev->nextNode = traverse->nextNode;
-		free(traverse);
+		priqueue_pool_put(q->pool, traverse);
 		q->size--;
 		return data;
 	}
@@ -206,6 +919,83 @@ void *priqueue_remove_at(priqueue_t *q, int index)
 }
 
 
+//Unlinks n from the sorted list backend; the list has no back links, so this walks from the head
+static void listUnlink(priqueue_t *q, node* n)
+{
+	if (q->head == n) {
+		q->head = n->nextNode;
+	} else {
+		node* prev = q->head;
+		while (prev->nextNode != n) {
+			prev = prev->nextNode;
+		}
+		prev->nextNode = n->nextNode;
+	}
+	n->nextNode = NULL;
+	q->size--;
+}
+
+
+/**
+  Removes the element referred to by handle from the queue.
+
+  O(log n) for PRIQUEUE_HEAP and PRIQUEUE_TREE, O(1) at either end of a PRIQUEUE_FIFO (and
+  proportional to the distance from the nearer end otherwise), and O(n)
+  for PRIQUEUE_LIST.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param handle a handle returned by priqueue_offer_handle() that is still in q
+  @return the element removed from the queue
+ */
+void *priqueue_remove_handle(priqueue_t *q, priqueue_handle_t handle)
+{
+	if (q->backend == PRIQUEUE_HEAP) {
+		heapOrderStale(q);
+		heapRemoveSlot(q, q->slots, &q->size, handle->index);
+	} else if (q->backend == PRIQUEUE_FIFO) {
+		int index = handle->index - q->first;
+		if (index < 0) {
+			index += q->capacity;
+		}
+		fifoRemoveIndex(q, index);
+	} else if (q->backend == PRIQUEUE_TREE) {
+		treeErase(q, handle);
+	} else {
+		listUnlink(q, handle);
+	}
+
+	void *data = handle->data;
+	priqueue_pool_put(q->pool, handle);
+	return data;
+}
+
+
+/**
+  Restores the ordering after the element referred to by handle changed the
+  fields the comparer looks at. The element keeps its place among equal
+  elements in PRIQUEUE_LIST, PRIQUEUE_HEAP and PRIQUEUE_TREE, and
+  PRIQUEUE_FIFO leaves it where it is.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param handle a handle returned by priqueue_offer_handle() that is still in q
+ */
+void priqueue_update_handle(priqueue_t *q, priqueue_handle_t handle)
+{
+	if (q->backend == PRIQUEUE_HEAP) {
+		heapOrderStale(q);
+		if (heapSiftUp(q, q->slots, handle->index) == handle->index) {
+			heapSiftDown(q, q->slots, q->size, handle->index);
+		}
+	} else if (q->backend == PRIQUEUE_TREE) {
+		treeErase(q, handle);
+		treeInsert(q, handle);
+	} else if (q->backend == PRIQUEUE_LIST) {
+		listUnlink(q, handle);
+		linkNode(q, handle);
+	}
+}
+
+
 /**
   Returns the number of elements in the queue.
 
@@ -225,5 +1015,17 @@ int priqueue_size(priqueue_t *q)
  */
 void priqueue_destroy(priqueue_t *q)
 {
-	while (priqueue_poll(q) != NULL) {}
+	while (q->size > 0) {
+		priqueue_poll(q);
+	}
+	if (q->pool == &q->ownPool) {
+		priqueue_pool_destroy(&q->ownPool);
+	}
+	free(q->slots);
+	q->slots = NULL;
+	free(q->ordered);
+	q->ordered = NULL;
+	q->nOrdered = -1;
+	q->capacity = 0;
+	q->first = 0;
 }
@@ -10,10 +10,75 @@
 typedef struct node {
   void* data;
   struct node* nextNode;
+  unsigned long seq;
+  int index;
+  struct node* child[2];  ///< PRIQUEUE_TREE: left and right subtrees
+  struct node* parent;    ///< PRIQUEUE_TREE: NULL at the root
+  int red;                ///< PRIQUEUE_TREE: node colour
 } node;
 
 node* newNode();
 
+/**
+  One block of nodes carved out by a priqueue_pool_t
+*/
+typedef struct _priqueue_slab_t {
+  struct _priqueue_slab_t* next;
+  int count;
+  node nodes[];
+} priqueue_slab_t;
+
+/**
+  Free-list allocator for queue nodes. Nodes are recycled through the free
+  list and only handed back to the system when the pool is destroyed.
+  A pool may be shared by several queues as long as they are all used from
+  the same thread.
+*/
+typedef struct _priqueue_pool_t {
+  node* freeList;
+  priqueue_slab_t* slabs;
+  int nextSlab;
+} priqueue_pool_t;
+
+void   priqueue_pool_init   (priqueue_pool_t *pool, int capacity);
+node*  priqueue_pool_get    (priqueue_pool_t *pool);
+void   priqueue_pool_put    (priqueue_pool_t *pool, node *n);
+void   priqueue_pool_destroy(priqueue_pool_t *pool);
+
+/**
+  Stable reference to an element that is sitting in a queue
+*/
+typedef node* priqueue_handle_t;
+
+/**
+  Storage layouts a priqueue_t can be built on
+*/
+typedef enum {
+  PRIQUEUE_LIST = 0, ///< sorted singly linked list, O(n) offer
+  PRIQUEUE_HEAP,     ///< array-based binary heap, O(log n) offer/poll
+  PRIQUEUE_FIFO,     ///< growable ring buffer, O(1) offer/poll; ignores the comparer
+  PRIQUEUE_TREE      ///< red-black tree with a cached leftmost node, O(log n) offer/poll/remove, O(1) peek
+} priqueue_backend_t;
+
+/**
+  Options handed to priqueue_init_attr(). A zeroed struct gives the defaults.
+*/
+typedef struct _priqueue_attr_t {
+  priqueue_backend_t backend;
+  int capacity;          ///< number of elements to preallocate room for
+  priqueue_pool_t* pool; ///< shared node pool, or NULL for a private one
+} priqueue_attr_t;
+
+/**
+  Counters a queue keeps when the library is built with -DSCHED_STATS.
+  They stay zero otherwise.
+*/
+typedef struct _priqueue_stats_t {
+  unsigned long long comparisons; ///< calls to the comparer
+  unsigned long long traversed;   ///< nodes an offer (or handle update) walked past
+  unsigned long long allocations; ///< offers that had to malloc: a node slab or a bigger slot array
+} priqueue_stats_t;
+
 /**
   Priqueue Data Structure
 */
@@ -21,16 +86,34 @@ typedef struct _priqueue_t {
   int size;
   node* head;
   int(*compare)(const void*, const void*);
+  int(*compareUser)(const void*, const void*, void*); ///< set by priqueue_init_user(), used over compare
+  void* user;
+  priqueue_backend_t backend;
+  node** slots;
+  int capacity;
+  int first;
+  unsigned long seq;
+  priqueue_pool_t* pool;
+  priqueue_pool_t ownPool;
+  priqueue_stats_t stats;
+  node* leftmost;        ///< PRIQUEUE_TREE: first node in order, the root is kept in head
+  node** ordered;        ///< PRIQUEUE_HEAP: the elements in order, built by priqueue_at()/priqueue_remove_at()
+  int nOrdered;          ///< elements in ordered, -1 once the heap has changed since
 } priqueue_t;
 
 void   priqueue_init     (priqueue_t *q, int(*comparer)(const void *, const void *));
+void   priqueue_init_attr(priqueue_t *q, int(*comparer)(const void *, const void *), const priqueue_attr_t *attr);
+void   priqueue_init_user(priqueue_t *q, int(*comparer)(const void *, const void *, void *), void *user, const priqueue_attr_t *attr);
 
 int    priqueue_offer    (priqueue_t *q, void *ptr);
+priqueue_handle_t priqueue_offer_handle(priqueue_t *q, void *ptr);
 void * priqueue_peek     (priqueue_t *q);
 void * priqueue_poll     (priqueue_t *q);
 void * priqueue_at       (priqueue_t *q, int index);
 int    priqueue_remove   (priqueue_t *q, void *ptr);
 void * priqueue_remove_at(priqueue_t *q, int index);
+void * priqueue_remove_handle(priqueue_t *q, priqueue_handle_t handle);
+void   priqueue_update_handle(priqueue_t *q, priqueue_handle_t handle);
 int    priqueue_size     (priqueue_t *q);
 
 void   priqueue_destroy  (priqueue_t *q);
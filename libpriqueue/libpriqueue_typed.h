@@ -0,0 +1,297 @@
+/** @file libpriqueue_typed.h
+ */
+
+#ifndef LIBPRIQUEUE_TYPED_H_
+#define LIBPRIQUEUE_TYPED_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpriqueue.h"
+
+/**
+  Counts into a typed queue's stats when built with -DSCHED_STATS, the same
+  counters priqueue_t keeps.
+*/
+#ifdef SCHED_STATS
+#define PRIQUEUE_TYPED_STAT(q, counter) ((q)->stats.counter++)
+#else
+#define PRIQUEUE_TYPED_STAT(q, counter) ((void)0)
+#endif
+
+/**
+  Generates a binary heap specialized for one element type and comparer.
+
+  PRIQUEUE_DEFINE(name, type, cmp) declares name_t and the static inline
+  functions name_init(), name_offer(), name_offer_all(), name_peek(),
+  name_poll(), name_size() and name_destroy(). The heap stores elements of type by value
+  (a pointer, an index into a table, a key...) and calls
+  cmp(const type*, const type*, void* user) by name, so the compiler can
+  inline it; user is whatever was handed to name_init(). Elements cmp
+  reports as equal come out in insertion order, the same as priqueue_t.
+  name_offer_all() adds n elements as if offered one by one, rebuilding the
+  heap bottom-up in O(size + n) when that beats n separate sift-ups.
+  q->stats holds the priqueue_stats_t counters under -DSCHED_STATS.
+*/
+#define PRIQUEUE_DEFINE(name, type, cmp)                                      \
+typedef struct {                                                              \
+  type item;                                                                  \
+  unsigned long seq;                                                          \
+} name##_entry_t;                                                             \
+                                                                              \
+typedef struct {                                                              \
+  name##_entry_t* heap;                                                       \
+  int size;                                                                   \
+  int capacity;                                                               \
+  unsigned long seq;                                                          \
+  void* user;                                                                 \
+  priqueue_stats_t stats;                                                     \
+} name##_t;                                                                   \
+                                                                              \
+static inline int name##_less(name##_t* q, const name##_entry_t* a, const name##_entry_t* b) \
+{                                                                             \
+  PRIQUEUE_TYPED_STAT(q, comparisons);                                        \
+  int c = cmp(&a->item, &b->item, q->user);                                   \
+  return c != 0 ? c < 0 : a->seq < b->seq;                                    \
+}                                                                             \
+                                                                              \
+static inline void name##_init(name##_t* q, int capacity, void* user)         \
+{                                                                             \
+  q->size = 0;                                                                \
+  q->user = user;                                                             \
+  q->capacity = capacity;                                                     \
+  q->seq = 0;                                                                 \
+  q->stats = (priqueue_stats_t) { 0, 0, 0 };                                  \
+  q->heap = capacity > 0 ? (name##_entry_t*)malloc(sizeof(name##_entry_t) * capacity) : NULL; \
+}                                                                             \
+                                                                              \
+static inline int name##_size(const name##_t* q)                              \
+{                                                                             \
+  return q->size;                                                             \
+}                                                                             \
+                                                                              \
+static inline int name##_peek(const name##_t* q, type* out)                   \
+{                                                                             \
+  if (q->size == 0) {                                                         \
+    return 0;                                                                 \
+  }                                                                           \
+  *out = q->heap[0].item;                                                     \
+  return 1;                                                                   \
+}                                                                             \
+                                                                              \
+static inline void name##_offer(name##_t* q, type item)                       \
+{                                                                             \
+  if (q->size == q->capacity) {                                               \
+    PRIQUEUE_TYPED_STAT(q, allocations);                                      \
+    q->capacity = q->capacity ? q->capacity * 2 : 16;                         \
+    q->heap = (name##_entry_t*)realloc(q->heap, sizeof(name##_entry_t) * q->capacity); \
+  }                                                                           \
+  name##_entry_t moving = { item, q->seq++ };                                 \
+  int slot = q->size++;                                                       \
+  while (slot > 0 && name##_less(q, &moving, &q->heap[(slot - 1) / 2])) {     \
+    q->heap[slot] = q->heap[(slot - 1) / 2];                                  \
+    slot = (slot - 1) / 2;                                                    \
+    PRIQUEUE_TYPED_STAT(q, traversed);                                        \
+  }                                                                           \
+  q->heap[slot] = moving;                                                     \
+}                                                                             \
+                                                                              \
+static inline void name##_sift_down(name##_t* q, int slot, name##_entry_t moving) \
+{                                                                             \
+  for (;;) {                                                                  \
+    int child = 2 * slot + 1;                                                 \
+    if (child >= q->size) {                                                   \
+      break;                                                                  \
+    }                                                                         \
+    if (child + 1 < q->size && name##_less(q, &q->heap[child + 1], &q->heap[child])) { \
+      child++;                                                                \
+    }                                                                         \
+    if (!name##_less(q, &q->heap[child], &moving)) {                          \
+      break;                                                                  \
+    }                                                                         \
+    q->heap[slot] = q->heap[child];                                           \
+    slot = child;                                                             \
+  }                                                                           \
+  q->heap[slot] = moving;                                                     \
+}                                                                             \
+                                                                              \
+static inline void name##_offer_all(name##_t* q, const type* items, int n)    \
+{                                                                             \
+  int total = q->size + n;                                                    \
+  if (n <= 0) {                                                               \
+    return;                                                                   \
+  }                                                                           \
+  /* n sift-ups cost about n log(total), a rebuild about 2 total */          \
+  if ((long long)n * (32 - __builtin_clz((unsigned)total)) < 2LL * total) {   \
+    for (int i = 0; i < n; i++) {                                             \
+      name##_offer(q, items[i]);                                              \
+    }                                                                         \
+    return;                                                                   \
+  }                                                                           \
+  if (total > q->capacity) {                                                  \
+    PRIQUEUE_TYPED_STAT(q, allocations);                                      \
+    q->capacity = total;                                                      \
+    q->heap = (name##_entry_t*)realloc(q->heap, sizeof(name##_entry_t) * q->capacity); \
+  }                                                                           \
+  for (int i = 0; i < n; i++) {                                               \
+    name##_entry_t entry = { items[i], q->seq++ };                            \
+    q->heap[q->size++] = entry;                                               \
+  }                                                                           \
+  for (int slot = q->size / 2 - 1; slot >= 0; slot--) {                       \
+    name##_sift_down(q, slot, q->heap[slot]);                                 \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+static inline int name##_poll(name##_t* q, type* out)                         \
+{                                                                             \
+  if (q->size == 0) {                                                         \
+    return 0;                                                                 \
+  }                                                                           \
+  *out = q->heap[0].item;                                                     \
+  name##_entry_t moving = q->heap[--q->size];                                 \
+  if (q->size > 0) {                                                          \
+    name##_sift_down(q, 0, moving);                                           \
+  }                                                                           \
+  return 1;                                                                   \
+}                                                                             \
+                                                                              \
+static inline void name##_destroy(name##_t* q)                                \
+{                                                                             \
+  free(q->heap);                                                              \
+  q->heap = NULL;                                                             \
+  q->size = q->capacity = 0;                                                  \
+}
+
+/**
+  Generates a bucket queue for elements whose order is led by a small
+  integer level, the way the Linux O(1) scheduler keeps its run queues.
+
+  PRIQUEUE_DEFINE_BUCKET(name, type, levelOf, cmp, levels) declares name_t
+  and static inline name_init(), name_offer(), name_peek(), name_poll(),
+  name_size() and name_destroy(). Each of the levels levels (a constant) is
+  its own ring buffer, and a bitmap of non-empty levels lets poll find the
+  lowest one with a count-trailing-zeros. levelOf(const type*, void* user)
+  must return a level in [0, levels); lower levels come out first. Within a
+  level, elements are kept sorted by cmp(const type*, const type*, void*
+  user). Equal elements come out in insertion order.
+
+  Poll and peek are O(levels / 64). Offer is O(1) when the new element
+  sorts before the level's head, which it then joins the ring in front of,
+  or not before its tail, so a level filled in ascending or descending
+  order stays O(1) per offer, and so does a preempted job going back to
+  the head of its level. Anything else shifts every element that cmp puts
+  after the new one, from the tail, so a level filled in random order is
+  O(n^2) overall, like the sorted list; use the heap for that.
+
+  This is a generated type, not a priqueue_backend_t: levelOf and cmp work
+  on type by value, which priqueue_t's void* elements cannot offer.
+  q->stats holds the priqueue_stats_t counters under -DSCHED_STATS.
+*/
+#define PRIQUEUE_DEFINE_BUCKET(name, type, levelOf, cmp, levels)              \
+typedef struct {                                                              \
+  type* items;                                                                \
+  int first;                                                                  \
+  int count;                                                                  \
+  int capacity;                                                               \
+} name##_level_t;                                                             \
+                                                                              \
+typedef struct {                                                              \
+  name##_level_t level[levels];                                               \
+  unsigned long long used[((levels) + 63) / 64];                              \
+  int size;                                                                   \
+  void* user;                                                                 \
+  priqueue_stats_t stats;                                                     \
+} name##_t;                                                                   \
+                                                                              \
+static inline void name##_init(name##_t* q, void* user)                       \
+{                                                                             \
+  memset(q, 0, sizeof(*q));                                                   \
+  q->user = user;                                                             \
+}                                                                             \
+                                                                              \
+static inline int name##_size(const name##_t* q)                              \
+{                                                                             \
+  return q->size;                                                             \
+}                                                                             \
+                                                                              \
+static inline int name##_top(const name##_t* q)                               \
+{                                                                             \
+  for (int w = 0; w < ((levels) + 63) / 64; w++) {                            \
+    if (q->used[w] != 0) {                                                    \
+      return w * 64 + __builtin_ctzll(q->used[w]);                            \
+    }                                                                         \
+  }                                                                           \
+  return -1;                                                                  \
+}                                                                             \
+                                                                              \
+static inline void name##_offer(name##_t* q, type item)                       \
+{                                                                             \
+  int l = levelOf(&item, q->user);                                            \
+  name##_level_t* b = &q->level[l];                                           \
+  if (b->count == b->capacity) {                                              \
+    PRIQUEUE_TYPED_STAT(q, allocations);                                      \
+    int capacity = b->capacity ? b->capacity * 2 : 16;                        \
+    type* items = (type*)malloc(sizeof(type) * capacity);                     \
+    for (int i = 0; i < b->count; i++) {                                      \
+      items[i] = b->items[(b->first + i) & (b->capacity - 1)];                \
+    }                                                                         \
+    free(b->items);                                                           \
+    b->items = items;                                                         \
+    b->first = 0;                                                             \
+    b->capacity = capacity;                                                   \
+  }                                                                           \
+  int mask = b->capacity - 1, pos = b->count;                                 \
+  if (pos > 0 && (PRIQUEUE_TYPED_STAT(q, comparisons),                        \
+                  cmp(&b->items[(b->first + pos - 1) & mask], &item, q->user) > 0) && \
+      (pos == 1 || (PRIQUEUE_TYPED_STAT(q, comparisons),                      \
+                    cmp(&b->items[b->first], &item, q->user) > 0))) {         \
+    b->first = (b->first - 1) & mask;                                         \
+    pos = 0;                                                                  \
+  }                                                                           \
+  while (pos > 0 && (PRIQUEUE_TYPED_STAT(q, comparisons),                     \
+                     cmp(&b->items[(b->first + pos - 1) & mask], &item, q->user) > 0)) { \
+    b->items[(b->first + pos) & mask] = b->items[(b->first + pos - 1) & mask]; \
+    pos--;                                                                    \
+    PRIQUEUE_TYPED_STAT(q, traversed);                                        \
+  }                                                                           \
+  b->items[(b->first + pos) & mask] = item;                                   \
+  b->count++;                                                                 \
+  q->size++;                                                                  \
+  q->used[l / 64] |= 1ULL << (l % 64);                                        \
+}                                                                             \
+                                                                              \
+static inline int name##_peek(const name##_t* q, type* out)                   \
+{                                                                             \
+  int l = name##_top(q);                                                      \
+  if (l == -1) {                                                              \
+    return 0;                                                                 \
+  }                                                                           \
+  *out = q->level[l].items[q->level[l].first];                                \
+  return 1;                                                                   \
+}                                                                             \
+                                                                              \
+static inline int name##_poll(name##_t* q, type* out)                         \
+{                                                                             \
+  int l = name##_top(q);                                                      \
+  if (l == -1) {                                                              \
+    return 0;                                                                 \
+  }                                                                           \
+  name##_level_t* b = &q->level[l];                                           \
+  *out = b->items[b->first];                                                  \
+  b->first = (b->first + 1) & (b->capacity - 1);                              \
+  q->size--;                                                                  \
+  if (--b->count == 0) {                                                      \
+    q->used[l / 64] &= ~(1ULL << (l % 64));                                   \
+  }                                                                           \
+  return 1;                                                                   \
+}                                                                             \
+                                                                              \
+static inline void name##_destroy(name##_t* q)                                \
+{                                                                             \
+  for (int l = 0; l < (levels); l++) {                                        \
+    free(q->level[l].items);                                                  \
+  }                                                                           \
+  memset(q, 0, sizeof(*q));                                                   \
+}
+
+#endif /* LIBPRIQUEUE_TYPED_H_ */
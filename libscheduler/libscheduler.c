@@ -4,107 +4,663 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef SCHED_STATS
+#include <time.h>
+#endif
 
 #include "libscheduler.h"
 #include "../libpriqueue/libpriqueue.h"
+#include "../libpriqueue/libpriqueue_typed.h"
 
 
 /**
-  Stores information making up a job to be scheduled including any statistics.
+  Stores information making up the jobs to be scheduled including any statistics.
 
-  You may need to define some global variables or a struct to store your job queue elements.
+  The table is laid out as structure-of-arrays and jobs are referred to by
+  their index in it, so comparisons and per-core updates only touch the
+  fields they read. Indices of finished jobs are recycled through nextFree.
 */
-typedef struct _job_t
+typedef struct _job_table_t
 {
-  int jobNumber;
-  int arrivalTime;
-  int runTime;
-  int remainingTime;
-  int priority;
-  int initTime;
-  int lastTime;
-} job_t;
+  int* jobNumber;
+  int* arrivalTime;
+  int* runTime;
+  int* remainingTime;
+  int* priority;
+  int* initTime;
+  int* lastTime;
+  int* level;                ///< MLFQ level, only changed while the job is not queued
+  int* lastCore;             ///< core the job last ran on, -1 before its first dispatch
+  int* overhead;             ///< time the cost model has charged the job
+  long long* vruntime;       ///< CFS virtual runtime, in 1/CFS_VRUNTIME_SCALE of a time unit at nice 0
+  int* nextFree;             ///< next index on the free list
+  int freeList;              ///< first free index, -1 when every index is in use
+  int capacity;
+} job_table_t;
+
+//mQueue holds job indices, offset by one so that index 0 is not NULL
+#define JOB_TO_PTR(job) ((void*)(intptr_t)((job) + 1))
+#define PTR_TO_JOB(ptr) ((int)(intptr_t)(ptr) - 1)
 
 /**
  * This defines cores
  */
 typedef struct core {
   int nCores;
-  job_t** jobs;
+  int* jobs;                ///< job index on each core, -1 while idle
+  int* remaining;           ///< remaining time of each core's job when its current slice started
+  int* lastTime;            ///< time each core's current slice started
+  unsigned long long* idle; ///< bit i is set while core i has no job
+  unsigned long long* fresh;///< bit i is set while core i's job is on its first dispatch
+  int nIdleWords;
+  int ranked;               ///< keep the running heap below (preemptive schemes only)
+  int* running;             ///< max-heap of busy cores, the first job to preempt on top
+  int* runningPos;          ///< slot of each core in running, -1 when not in it
+  int nRunning;
+  int* lastJob;             ///< job most recently dispatched on each core, -1 once it finished
+  int* cost;                ///< what the cost model charged each core's current job on dispatch
 } core_t;
 
-scheme_t curScheme;
-priqueue_t* mQueue;
-core_t cpu;
-int currentTime = 0;
-double totalWaitTime = 0.0;
-int numWaiting = 0;
-double totalRespTime = 0.0;
-int numResponse = 0;
-double totalTurnAroundTime = 0.0;
-int numTurnAround = 0;
-
-int compare(const void* jobA, const void* jobB) {
-  int arrivalTimeA = ((job_t*)jobA)->arrivalTime;
-  int arrivalTimeB = ((job_t*)jobB)->arrivalTime;
-  int runningTimeA = ((job_t*)jobA)->runTime;
-  int runningTimeB = ((job_t*)jobB)->runTime;
-  int remainingTimeA = ((job_t*)jobA)->remainingTime;
-  int remainingTimeB = ((job_t*)jobB)->remainingTime;
-  int priorityA = ((job_t*)jobA)->priority;
-  int priorityB = ((job_t*)jobB)->priority;
-
-  int arrivalTimeDiff = arrivalTimeA - arrivalTimeB;
-  int runTimeDiff = runningTimeA - runningTimeB;
-  int remainingTimeDiff = remainingTimeA - remainingTimeB;
-  int priorityDiff = priorityA - priorityB;
-
-  switch (curScheme) {
-    case FCFS: {
-      return arrivalTimeDiff;
-      break;
-    }
-    case SJF: {
-      if (runTimeDiff == 0) {
-        return arrivalTimeDiff;
-      } else {
-        return runTimeDiff;
+/*
+ * One comparator per scheme. Each reads only the fields its scheme orders
+ * by, falling back on arrival time for ties.
+ */
+
+static inline int orderFCFS(const job_table_t* t, int a, int b) {
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+static inline int orderSJF(const job_table_t* t, int a, int b) {
+  if (t->runTime[a] != t->runTime[b]) {
+    return t->runTime[a] - t->runTime[b];
+  }
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+static inline int orderPSJF(const job_table_t* t, int a, int b) {
+  if (t->remainingTime[a] != t->remainingTime[b]) {
+    return t->remainingTime[a] - t->remainingTime[b];
+  }
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+//PRI and PPRI order the same way, they only differ in when they preempt
+static inline int orderPRI(const job_table_t* t, int a, int b) {
+  if (t->priority[a] != t->priority[b]) {
+    return t->priority[a] - t->priority[b];
+  }
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+#ifdef SCHED_STATS
+/*
+ * Opt-in instrumentation, built with -DSCHED_STATS (make STATS=1). Without
+ * it every STATS_* macro below expands to nothing, so the counters cost
+ * nothing in a normal build.
+ */
+
+//Entry points that get a latency histogram
+typedef enum {
+  STATS_NEW_JOB = 0,
+  STATS_JOB_FINISHED,
+  STATS_QUANTUM_EXPIRED,
+  STATS_SUBMIT_BATCH,
+  STATS_ENTRY_POINTS
+} stats_entry_t;
+
+static const char* statsEntryNames[STATS_ENTRY_POINTS] = {
+  "scheduler_new_job", "scheduler_job_finished", "scheduler_quantum_expired", "scheduler_submit_batch"
+};
+
+#define STATS_BUCKETS 40
+
+//Call latencies of one entry point, bucket i counting calls of [2^i, 2^(i+1)) ns
+typedef struct _stats_timer_t {
+  unsigned long long calls;
+  unsigned long long totalNs;
+  unsigned long long maxNs;
+  unsigned long long buckets[STATS_BUCKETS];
+} stats_timer_t;
+
+typedef struct _scheduler_stats_t {
+  unsigned long long comparisons;     ///< job comparisons, ready queue and running heap
+  unsigned long long allocations;     ///< times the job table had to grow
+  unsigned long long preemptAttempts; ///< calls to cpuCorePreempt
+  unsigned long long preemptions;     ///< of those, how many displaced a job
+  unsigned long long* switches;       ///< jobs dispatched onto each core
+  stats_timer_t timers[STATS_ENTRY_POINTS];
+} scheduler_stats_t;
+
+static inline unsigned long long statsNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void statsRecord(stats_timer_t* timer, unsigned long long ns) {
+  int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+  timer->buckets[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1]++;
+  timer->calls++;
+  timer->totalNs += ns;
+  if (ns > timer->maxNs) {
+    timer->maxNs = ns;
+  }
+}
+
+#define STATS_INC(ctx, counter) ((ctx)->stats.counter++)
+#define STATS_START(var) unsigned long long var = statsNow()
+#define STATS_STOP(ctx, entry, var) statsRecord(&(ctx)->stats.timers[entry], statsNow() - (var))
+#define STATS_USER(ctx) ((void*)&(ctx)->stats)
+#else
+#define STATS_INC(ctx, counter) ((void)0)
+#define STATS_START(var) ((void)0)
+#define STATS_STOP(ctx, entry, var) ((void)0)
+#define STATS_USER(ctx) NULL
+#endif
+
+//MLFQ ranks running jobs by level, so the preemption candidate is the one furthest down
+static inline int orderMLFQ(const job_table_t* t, int a, int b) {
+  if (t->level[a] != t->level[b]) {
+    return t->level[a] - t->level[b];
+  }
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+/**
+ * Ready queue entry with the job's ordering packed into a single integer:
+ * the scheme's primary field in the high 32 bits and the arrival time in
+ * the low 32, each with its sign bit flipped so signed values order
+ * correctly as unsigned. Every field that goes into the key is fixed while
+ * the job waits (PSJF's remaining time only changes while it runs), so the
+ * key is computed once at enqueue time.
+ */
+typedef struct _job_key_t {
+  uint64_t key;
+  int job;
+} job_key_t;
+
+static inline uint64_t packKey(int primary, int arrival) {
+  return ((uint64_t)((uint32_t)primary ^ 0x80000000u) << 32) | ((uint32_t)arrival ^ 0x80000000u);
+}
+
+//user is the owning context's statistics, or NULL when they are compiled out
+static inline int compareKeys(const job_key_t* a, const job_key_t* b, void* user) {
+#ifdef SCHED_STATS
+  ((scheduler_stats_t*)user)->comparisons++;
+#endif
+  return (a->key > b->key) - (a->key < b->key);
+}
+
+//FCFS and RR queue in arrival order on the FIFO backend, which never compares
+int compareNone(const void* jobA, const void* jobB) {
+  return 0;
+}
+
+//The level of a PRI/PPRI entry is its priority, the key's high half
+static inline int keyLevel(const job_key_t* a, void* user) {
+  return (int)((uint32_t)(a->key >> 32) ^ 0x80000000u);
+}
+
+//The bucket queue has a level for each priority in [0, SCHEDULER_PRIORITY_LEVELS), the same
+//ones that get their own statistics; anything outside falls back to the heap
+PRIQUEUE_DEFINE(keyQueue, job_key_t, compareKeys)
+PRIQUEUE_DEFINE_BUCKET(bucketQueue, job_key_t, keyLevel, compareKeys, SCHEDULER_PRIORITY_LEVELS)
+
+//MLFQ queues one FIFO per level: the level is read from the job table and ties never reorder
+static inline int mlfqLevel(const int* job, void* user) {
+  return ((const job_table_t*)user)->level[*job];
+}
+
+static inline int compareFifo(const int* a, const int* b, void* user) {
+  return 0;
+}
+
+PRIQUEUE_DEFINE_BUCKET(levelQueue, int, mlfqLevel, compareFifo, SCHEDULER_MLFQ_MAX_LEVELS)
+
+/*
+ * CFS weights, the Linux nice-to-weight table: each nice level is worth
+ * about 10% of the CPU against its neighbour, and nice 0 weighs 1024. A
+ * job's priority is read as its nice value, clamped to [-20, 19].
+ */
+static const int cfsWeights[40] = {
+  88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+  9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+  1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+  110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+
+#define CFS_NICE0_WEIGHT 1024
+#define CFS_VRUNTIME_SCALE 1024
+
+static inline int cfsWeight(int priority) {
+  return cfsWeights[(priority < -20 ? -20 : priority > 19 ? 19 : priority) + 20];
+}
+
+//CFS orders by virtual runtime, falling back on arrival time; user is the job table
+int compareVruntime(const void* jobA, const void* jobB, void* user) {
+  const job_table_t* t = (const job_table_t*)user;
+  int a = PTR_TO_JOB(jobA), b = PTR_TO_JOB(jobB);
+  if (t->vruntime[a] != t->vruntime[b]) {
+    return t->vruntime[a] < t->vruntime[b] ? -1 : 1;
+  }
+  return t->arrivalTime[a] - t->arrivalTime[b];
+}
+
+/**
+ * Log-linear histogram of non-negative times, the layout HDR histograms
+ * use: values below HIST_SUB get a slot each, and every power of two above
+ * is split into HIST_SUB slots, so any value is within 1/HIST_SUB of the
+ * slot it lands in. Memory is fixed however many values are added.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_SLOTS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct _time_hist_t {
+  long long count;
+  int max;
+  long long slots[HIST_SLOTS];
+} time_hist_t;
+
+static inline void histAdd(time_hist_t* h, int value) {
+  if (value < 0) {
+    value = 0;
+  }
+  int slot = value;
+  if (value >= HIST_SUB) {
+    int shift = (31 - __builtin_clz(value)) - HIST_SUB_BITS;
+    slot = shift * HIST_SUB + (value >> shift);
+  }
+  h->slots[slot]++;
+  h->count++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+//Middle of the slot that holds the value ranked fraction of the way up
+float histPercentile(const time_hist_t* h, double fraction) {
+  long long rank = (long long)(fraction * h->count + 0.999999), seen = 0;
+  if (rank < 1) {
+    rank = 1;
+  }
+  for (int slot = 0; slot < HIST_SLOTS; slot++) {
+    seen += h->slots[slot];
+    if (seen >= rank) {
+      if (slot < HIST_SUB) {
+        return slot;
       }
-      break;
+      int shift = slot / HIST_SUB - 1;
+      long long low = (long long)(slot % HIST_SUB + HIST_SUB) << shift;
+      float middle = low + ((1LL << shift) - 1) / 2.0f;
+      return middle < h->max ? middle : h->max;
     }
-    case PSJF: {
-      if (remainingTimeDiff == 0) {
-        return arrivalTimeDiff;
-      } else {
-        return remainingTimeDiff;
-      }
+  }
+  return h->max;
+}
+
+/**
+ * Cores ordered by how many jobs wait in their own ready queue, ties going
+ * to the lowest core id. Every core is always in the heap.
+ */
+typedef struct _load_heap_t {
+  int* heap;
+  int* pos;  ///< slot of each core in heap
+  int most;  ///< 1 to keep the most loaded core on top, 0 for the least loaded
+} load_heap_t;
+
+/**
+ * Everything one scheduler instance owns, so several can run side by side
+ */
+struct _scheduler_ctx_t {
+  scheme_t curScheme;
+  priqueue_t* mQueue;   ///< ready queue for FCFS and RR
+  keyQueue_t keyQueue;  ///< ready queue for SJF, PSJF, and PRI/PPRI once bucketed is cleared
+  bucketQueue_t bucketQueue; ///< ready queue for PRI and PPRI while every priority fits a level
+  int bucketed;
+  levelQueue_t mlfqQueue;  ///< ready queue for MLFQ
+  int mlfqLevels;
+  int mlfqQuanta[SCHEDULER_MLFQ_MAX_LEVELS];
+  int boostPeriod;         ///< MLFQ moves every job back to level 0 this often, never when 0
+  int nextBoost;
+  priqueue_t* fairQueue;   ///< ready queue for CFS, a tree ordered by vruntime
+  int cfsLatency;          ///< CFS period every runnable job should get a slice in
+  int cfsGranularity;      ///< CFS slice floor the period stretches to keep
+  long long minVruntime;   ///< vruntime of the last job CFS picked, never decreasing; arrivals start here
+  long long fairWeight;    ///< total weight of the jobs CFS has queued or running
+  int fairRunnable;
+  int batching;            ///< inside scheduler_submit_batch(): shared queue offers wait in pending
+  int* pending;            ///< jobs to queue at the end of the batch, in the order they were queued
+  int nPending;
+  int pendingCapacity;
+  int perCore;             ///< each core has its own ready queue in local, balanced by stealing
+  keyQueue_t* local;
+  load_heap_t leastLoaded; ///< where arrivals that find every core busy are queued
+  load_heap_t mostLoaded;  ///< where an idle core steals from
+  long long steals;
+  long long migrations;
+  long long queueOps;
+  scheduler_cost_model_t costs;
+  long long overhead;
+  long long charged[3];    ///< dispatches charged switch_cost, socket_cost and numa_cost
+  job_table_t table;
+  core_t cpu;
+  int currentTime;
+  double totalWaitTime;
+  int numWaiting;
+  double totalRespTime;
+  int numResponse;
+  double totalTurnAroundTime;
+  int numTurnAround;
+  time_hist_t hists[SCHEDULER_METRICS];  ///< every finished job
+  time_hist_t* priorityHists[SCHEDULER_PRIORITY_LEVELS + 1]; ///< per priority, allocated on first use; the last one is for out of range priorities
+#ifdef SCHED_STATS
+  scheduler_stats_t stats;
+#endif
+};
+
+//The instance behind the original global API
+scheduler_ctx_t* defaultCtx = NULL;
+
+//Compares two jobs under the context's scheme
+static inline int compare(scheduler_ctx_t* ctx, int a, int b) {
+  STATS_INC(ctx, comparisons);
+  switch (ctx->curScheme) {
+    case FCFS: return orderFCFS(&ctx->table, a, b);
+    case SJF:  return orderSJF(&ctx->table, a, b);
+    case PSJF: return orderPSJF(&ctx->table, a, b);
+    case PRI:
+    case PPRI: return orderPRI(&ctx->table, a, b);
+    case MLFQ: return orderMLFQ(&ctx->table, a, b);
+    default:   return 0;
+  }
+}
+
+/**
+ * Job table helpers
+ */
+
+//Grows every column to capacity, putting the new indices on the free list
+void jobTableGrow(job_table_t* t, int capacity) {
+  t->jobNumber = (int*)realloc(t->jobNumber, sizeof(int)*capacity);
+  t->arrivalTime = (int*)realloc(t->arrivalTime, sizeof(int)*capacity);
+  t->runTime = (int*)realloc(t->runTime, sizeof(int)*capacity);
+  t->remainingTime = (int*)realloc(t->remainingTime, sizeof(int)*capacity);
+  t->priority = (int*)realloc(t->priority, sizeof(int)*capacity);
+  t->initTime = (int*)realloc(t->initTime, sizeof(int)*capacity);
+  t->lastTime = (int*)realloc(t->lastTime, sizeof(int)*capacity);
+  t->level = (int*)realloc(t->level, sizeof(int)*capacity);
+  t->lastCore = (int*)realloc(t->lastCore, sizeof(int)*capacity);
+  t->overhead = (int*)realloc(t->overhead, sizeof(int)*capacity);
+  t->vruntime = (long long*)realloc(t->vruntime, sizeof(long long)*capacity);
+  t->nextFree = (int*)realloc(t->nextFree, sizeof(int)*capacity);
+
+  for (int i = capacity - 1; i >= t->capacity; i--) {
+    t->nextFree[i] = t->freeList;
+    t->freeList = i;
+  }
+  t->capacity = capacity;
+}
+
+void jobTableDestroy(job_table_t* t) {
+  free(t->jobNumber);
+  free(t->arrivalTime);
+  free(t->runTime);
+  free(t->remainingTime);
+  free(t->priority);
+  free(t->initTime);
+  free(t->lastTime);
+  free(t->level);
+  free(t->lastCore);
+  free(t->overhead);
+  free(t->vruntime);
+  free(t->nextFree);
+}
+
+//Takes an index off the free list, growing the table when it is empty
+int jobAlloc(job_table_t* t) {
+  if (t->freeList == -1) {
+    jobTableGrow(t, t->capacity ? t->capacity * 2 : 64);
+  }
+  int job = t->freeList;
+  t->freeList = t->nextFree[job];
+  return job;
+}
+
+void jobRelease(job_table_t* t, int job) {
+  t->nextFree[job] = t->freeList;
+  t->freeList = job;
+}
+
+/**
+ * Per-core run queue helpers. Every scheme's order fits a packed key, so
+ * each core's queue is a keyQueue; schemes that queue in FIFO order use a
+ * constant key and get it from the heap's insertion order.
+ */
+
+static inline uint64_t jobKey(scheduler_ctx_t* ctx, int job) {
+  const job_table_t* t = &ctx->table;
+  switch (ctx->curScheme) {
+    case SJF:  return packKey(t->runTime[job], t->arrivalTime[job]);
+    case PSJF: return packKey(t->remainingTime[job], t->arrivalTime[job]);
+    case PRI:
+    case PPRI: return packKey(t->priority[job], t->arrivalTime[job]);
+    case MLFQ: return packKey(t->level[job], 0);
+    //Whole time units are plenty to order a core's own queue by
+    case CFS:  return packKey((int)(t->vruntime[job] / CFS_VRUNTIME_SCALE), t->arrivalTime[job]);
+    default:   return packKey(0, 0);
+  }
+}
+
+static inline int loadBefore(scheduler_ctx_t* ctx, const load_heap_t* h, int a, int b) {
+  int sa = keyQueue_size(&ctx->local[a]), sb = keyQueue_size(&ctx->local[b]);
+  if (sa != sb) {
+    return h->most ? sa > sb : sa < sb;
+  }
+  return a < b;
+}
+
+void loadSift(scheduler_ctx_t* ctx, load_heap_t* h, int slot) {
+  int n = ctx->cpu.nCores, core = h->heap[slot];
+  while (slot > 0 && loadBefore(ctx, h, core, h->heap[(slot - 1) / 2])) {
+    h->heap[slot] = h->heap[(slot - 1) / 2];
+    h->pos[h->heap[slot]] = slot;
+    slot = (slot - 1) / 2;
+  }
+  for (;;) {
+    int child = 2 * slot + 1;
+    if (child >= n) {
       break;
     }
-    case PRI: {
-      if (priorityDiff == 0) {
-        return arrivalTimeDiff;
-      } else {
-        return priorityDiff;
-      }
-      break;
+    if (child + 1 < n && loadBefore(ctx, h, h->heap[child + 1], h->heap[child])) {
+      child++;
     }
-    case PPRI: {
-      if (priorityDiff == 0) {
-        return arrivalTimeDiff;
-      } else {
-        return priorityDiff;
-      }
+    if (!loadBefore(ctx, h, h->heap[child], core)) {
       break;
     }
-    case RR: {
-      return 0;
-      break;
+    h->heap[slot] = h->heap[child];
+    h->pos[h->heap[slot]] = slot;
+    slot = child;
+  }
+  h->heap[slot] = core;
+  h->pos[core] = slot;
+}
+
+void loadInit(load_heap_t* h, int cores, int most) {
+  h->heap = (int*)malloc(sizeof(int)*cores);
+  h->pos = (int*)malloc(sizeof(int)*cores);
+  h->most = most;
+  //Every queue starts empty, so core order is already a heap
+  for (int i = 0; i < cores; i++) {
+    h->heap[i] = i;
+    h->pos[i] = i;
+  }
+}
+
+void loadDestroy(load_heap_t* h) {
+  free(h->heap);
+  free(h->pos);
+}
+
+void localOffer(scheduler_ctx_t* ctx, int core, int job) {
+  job_key_t entry = { jobKey(ctx, job), job };
+  keyQueue_offer(&ctx->local[core], entry);
+  loadSift(ctx, &ctx->leastLoaded, ctx->leastLoaded.pos[core]);
+  loadSift(ctx, &ctx->mostLoaded, ctx->mostLoaded.pos[core]);
+}
+
+int localPoll(scheduler_ctx_t* ctx, int core) {
+  job_key_t entry;
+  if (!keyQueue_poll(&ctx->local[core], &entry)) {
+    return -1;
+  }
+  loadSift(ctx, &ctx->leastLoaded, ctx->leastLoaded.pos[core]);
+  loadSift(ctx, &ctx->mostLoaded, ctx->mostLoaded.pos[core]);
+  return entry.job;
+}
+
+//The core whose queue a job that finds every core busy waits on
+static inline int arrivalCore(scheduler_ctx_t* ctx) {
+  return ctx->perCore ? ctx->leastLoaded.heap[0] : 0;
+}
+
+/**
+ * Ready queue helpers, picking the scheme's queue. core is the core whose
+ * queue the job goes on, or is taken for, when every core has its own; the
+ * shared queues ignore it.
+ */
+
+//Puts a job on the shared queue of the scheme, whatever is pending
+void queueOffer(scheduler_ctx_t* ctx, int job) {
+  job_table_t* t = &ctx->table;
+  job_key_t entry = { 0, job };
+  switch (ctx->curScheme) {
+    case SJF:  entry.key = packKey(t->runTime[job], t->arrivalTime[job]); break;
+    case PSJF: entry.key = packKey(t->remainingTime[job], t->arrivalTime[job]); break;
+    case PRI:
+    case PPRI: entry.key = packKey(t->priority[job], t->arrivalTime[job]); break;
+    case MLFQ:
+      levelQueue_offer(&ctx->mlfqQueue, job);
+      return;
+    case CFS:
+      priqueue_offer(ctx->fairQueue, JOB_TO_PTR(job));
+      return;
+    default:
+      priqueue_offer(ctx->mQueue, JOB_TO_PTR(job));
+      return;
+  }
+
+  if (ctx->bucketed) {
+    if (t->priority[job] >= 0 && t->priority[job] < SCHEDULER_PRIORITY_LEVELS) {
+      bucketQueue_offer(&ctx->bucketQueue, entry);
+      return;
     }
-    default: {
-      break;
+
+    //Priority range too wide for the buckets: move everything to the heap for good.
+    //Draining in order keeps equal keys in the same order there.
+    job_key_t moved;
+    while (bucketQueue_poll(&ctx->bucketQueue, &moved)) {
+      keyQueue_offer(&ctx->keyQueue, moved);
     }
+    ctx->bucketed = 0;
   }
-  return 0;
+  keyQueue_offer(&ctx->keyQueue, entry);
+}
+
+//Queues everything a batch held back. The heap takes it in one go, so it can
+//rebuild instead of sifting each job in; the other queues are O(1) (or ordered
+//per job anyway) and take it one job at a time.
+void queueFlush(scheduler_ctx_t* ctx) {
+  int n = ctx->nPending;
+  ctx->nPending = 0;
+  int heaped = (ctx->curScheme == SJF || ctx->curScheme == PSJF) ||
+               ((ctx->curScheme == PRI || ctx->curScheme == PPRI) && !ctx->bucketed);
+  if (!heaped) {
+    for (int i = 0; i < n; i++) {
+      queueOffer(ctx, ctx->pending[i]);
+    }
+    return;
+  }
+
+  job_key_t* entries = (job_key_t*)malloc(sizeof(job_key_t) * n);
+  for (int i = 0; i < n; i++) {
+    entries[i].key = jobKey(ctx, ctx->pending[i]);
+    entries[i].job = ctx->pending[i];
+  }
+  keyQueue_offer_all(&ctx->keyQueue, entries, n);
+  free(entries);
+}
+
+//Takes the head of the shared queue of the scheme, or -1 when it is empty
+int queuePoll(scheduler_ctx_t* ctx) {
+  if (ctx->curScheme == FCFS || ctx->curScheme == RR) {
+    return PTR_TO_JOB(priqueue_poll(ctx->mQueue));
+  }
+
+  if (ctx->curScheme == MLFQ) {
+    int job;
+    return levelQueue_poll(&ctx->mlfqQueue, &job) ? job : -1;
+  }
+
+  if (ctx->curScheme == CFS) {
+    return PTR_TO_JOB(priqueue_poll(ctx->fairQueue));
+  }
+
+  job_key_t entry;
+  if (ctx->bucketed) {
+    return bucketQueue_poll(&ctx->bucketQueue, &entry) ? entry.job : -1;
+  }
+  return keyQueue_poll(&ctx->keyQueue, &entry) ? entry.job : -1;
+}
+
+void queueJob(scheduler_ctx_t* ctx, int job, int core) {
+  ctx->queueOps++;
+  if (ctx->perCore) {
+    localOffer(ctx, core, job);
+    return;
+  }
+  if (ctx->batching) {
+    if (ctx->nPending == ctx->pendingCapacity) {
+      ctx->pendingCapacity = ctx->pendingCapacity ? ctx->pendingCapacity * 2 : 64;
+      ctx->pending = (int*)realloc(ctx->pending, sizeof(int) * ctx->pendingCapacity);
+    }
+    ctx->pending[ctx->nPending++] = job;
+    return;
+  }
+  queueOffer(ctx, job);
+}
+
+//Returns the next job to run, or -1 when the queue is empty. A core whose own
+//queue is empty steals the best job of the busiest core's queue.
+int dequeueJob(scheduler_ctx_t* ctx, int core) {
+  ctx->queueOps++;
+  if (ctx->perCore) {
+    int job = localPoll(ctx, core);
+    int busiest = ctx->mostLoaded.heap[0];
+    if (job == -1 && busiest != core && (job = localPoll(ctx, busiest)) != -1) {
+      ctx->steals++;
+    }
+    return job;
+  }
+  if (ctx->nPending > 0) {
+    queueFlush(ctx);
+  }
+
+  if (ctx->curScheme == FCFS || ctx->curScheme == RR) {
+    //Affinity: a job close to the head that last ran on this core goes first
+    int pick = 0;
+    for (int i = 0; i < ctx->costs.affinity_window && i < priqueue_size(ctx->mQueue); i++) {
+      if (ctx->table.lastCore[PTR_TO_JOB(priqueue_at(ctx->mQueue, i))] == core) {
+        pick = i;
+        break;
+      }
+    }
+    if (pick > 0) {
+      return PTR_TO_JOB(priqueue_remove_at(ctx->mQueue, pick));
+    }
+  }
+  return queuePoll(ctx);
 }
 
 /**
@@ -113,124 +669,432 @@ int compare(const void* jobA, const void* jobB) {
 
 /**
  * Initalizes the CPU emulator
- * @param cpu   the pointer to the current cpu object
- * @param cores number of cores the cpu should emulate
+ * @param cpu    the pointer to the current cpu object
+ * @param cores  number of cores the cpu should emulate
+ * @param scheme the scheme the cores will be scheduled with
  */
-void cpuInit(core_t* cpu, int cores) {
+void cpuInit(core_t* cpu, int cores, scheme_t scheme) {
   cpu->nCores = cores;
-  cpu->jobs = (job_t**)malloc(sizeof(job_t)*cores);
+  cpu->jobs = (int*)malloc(sizeof(int)*cores);
+  cpu->remaining = (int*)calloc(cores, sizeof(int));
+  cpu->lastTime = (int*)calloc(cores, sizeof(int));
+  cpu->nIdleWords = (cores + 63) / 64;
+  cpu->idle = (unsigned long long*)calloc(cpu->nIdleWords, sizeof(unsigned long long));
+  cpu->fresh = (unsigned long long*)calloc(cpu->nIdleWords, sizeof(unsigned long long));
+  cpu->ranked = (scheme == PSJF || scheme == PPRI || scheme == MLFQ);
+  cpu->running = (int*)malloc(sizeof(int)*cores);
+  cpu->runningPos = (int*)malloc(sizeof(int)*cores);
+  cpu->nRunning = 0;
+  cpu->lastJob = (int*)malloc(sizeof(int)*cores);
+  cpu->cost = (int*)calloc(cores, sizeof(int));
 
   for (int i = 0; i < cores; i++) {
-    cpu->jobs[i] = NULL;
+    cpu->jobs[i] = -1;
+    cpu->idle[i / 64] |= 1ULL << (i % 64);
+    cpu->runningPos[i] = -1;
+    cpu->lastJob[i] = -1;
   }
 }
 
 /**
- * Updates time of all jobs in cpu
- * @param time the current time being updated to
+ * Frees everything cpuInit allocated
+ * @param cpu   the pointer to the current cpu object
  */
-void cpuUpdateTime(int time) {
-  job_t* job = NULL;
-  currentTime = time;
+void cpuDestroy(core_t* cpu) {
+  free(cpu->jobs);
+  free(cpu->remaining);
+  free(cpu->lastTime);
+  free(cpu->idle);
+  free(cpu->fresh);
+  free(cpu->running);
+  free(cpu->runningPos);
+  free(cpu->lastJob);
+  free(cpu->cost);
+}
 
-  for (int i = 0; i < cpu.nCores; i++) {
-    job = cpu.jobs[i];
-    if (job != NULL) {
-      if (job->initTime == -1 && job->lastTime != time) {
-        job->initTime = job->lastTime;
+/*
+ * Running heap helpers. Every running job's remaining time drops by the same
+ * amount in cpuUpdateTime, so their relative order only changes when a core
+ * is assigned or freed.
+ */
 
-        totalRespTime += job->initTime - job->arrivalTime;
-        numResponse++;
-      }
+//Copies a core's remaining time, as of now, back into the job table
+static inline void cpuSyncCore(scheduler_ctx_t* ctx, int core) {
+  const core_t* cpu = &ctx->cpu;
+  ctx->table.remainingTime[cpu->jobs[core]] = cpu->remaining[core] - (ctx->currentTime - cpu->lastTime[core]);
+}
+
+//True when the job on core a should be preempted before the one on core b
+int runningBefore(scheduler_ctx_t* ctx, int a, int b) {
+  cpuSyncCore(ctx, a);
+  cpuSyncCore(ctx, b);
+  int cmp = compare(ctx, ctx->cpu.jobs[a], ctx->cpu.jobs[b]);
+  if (cmp != 0) {
+    return cmp > 0;
+  }
+  return a < b;
+}
+
+void runningPlace(core_t* cpu, int slot, int core) {
+  cpu->running[slot] = core;
+  cpu->runningPos[core] = slot;
+}
+
+void runningSift(scheduler_ctx_t* ctx, int slot) {
+  core_t* cpu = &ctx->cpu;
+  int core = cpu->running[slot];
+  while (slot > 0 && runningBefore(ctx, core, cpu->running[(slot - 1) / 2])) {
+    runningPlace(cpu, slot, cpu->running[(slot - 1) / 2]);
+    slot = (slot - 1) / 2;
+  }
+  for (;;) {
+    int child = 2 * slot + 1;
+    if (child >= cpu->nRunning) {
+      break;
+    }
+    if (child + 1 < cpu->nRunning && runningBefore(ctx, cpu->running[child + 1], cpu->running[child])) {
+      child++;
+    }
+    if (!runningBefore(ctx, cpu->running[child], core)) {
+      break;
+    }
+    runningPlace(cpu, slot, cpu->running[child]);
+    slot = child;
+  }
+  runningPlace(cpu, slot, core);
+}
+
+void runningInsert(scheduler_ctx_t* ctx, int core) {
+  runningPlace(&ctx->cpu, ctx->cpu.nRunning++, core);
+  runningSift(ctx, ctx->cpu.nRunning - 1);
+}
+
+void runningRemove(scheduler_ctx_t* ctx, int core) {
+  core_t* cpu = &ctx->cpu;
+  int slot = cpu->runningPos[core];
+  cpu->runningPos[core] = -1;
+  cpu->nRunning--;
+  if (slot != cpu->nRunning) {
+    runningPlace(cpu, slot, cpu->running[cpu->nRunning]);
+    runningSift(ctx, slot);
+  }
+}
+
+/**
+ * Moves every MLFQ job, queued or running, back to the top level. Queued
+ * jobs keep their relative order (the higher levels' ahead), and the
+ * running heap is rebuilt since its order depends on the levels.
+ */
+void mlfqBoost(scheduler_ctx_t* ctx) {
+  job_table_t* t = &ctx->table;
+  core_t* cpu = &ctx->cpu;
+  int count = levelQueue_size(&ctx->mlfqQueue);
+  int* queued = (int*)malloc(sizeof(int) * (count + 1));
+  for (int i = 0; i < count; i++) {
+    levelQueue_poll(&ctx->mlfqQueue, &queued[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    t->level[queued[i]] = 0;
+    levelQueue_offer(&ctx->mlfqQueue, queued[i]);
+  }
+  free(queued);
+
+  //Per-core queues are drained and refilled the same way, one core at a time
+  for (int c = 0; ctx->perCore && c < cpu->nCores; c++) {
+    count = keyQueue_size(&ctx->local[c]);
+    job_key_t* entries = (job_key_t*)malloc(sizeof(job_key_t) * (count + 1));
+    for (int i = 0; i < count; i++) {
+      keyQueue_poll(&ctx->local[c], &entries[i]);
+    }
+    for (int i = 0; i < count; i++) {
+      t->level[entries[i].job] = 0;
+      entries[i].key = jobKey(ctx, entries[i].job);
+      keyQueue_offer(&ctx->local[c], entries[i]);
+    }
+    free(entries);
+  }
 
-      job->remainingTime = job->remainingTime - (time - job->lastTime);
-      job->lastTime = time;
+  cpu->nRunning = 0;
+  for (int i = 0; i < cpu->nCores; i++) {
+    if (cpu->jobs[i] != -1) {
+      t->level[cpu->jobs[i]] = 0;
+      runningInsert(ctx, i);
     }
   }
 }
 
+/**
+ * Updates the time of the cpu. Running jobs are accounted lazily: a core
+ * only records when its job's slice started, and the remaining time is
+ * worked out from that when the job leaves the core or is compared.
+ * @param time the current time being updated to
+ */
+void cpuUpdateTime(scheduler_ctx_t* ctx, int time) {
+  ctx->currentTime = time;
+  if (ctx->curScheme == MLFQ && ctx->boostPeriod > 0 && time >= ctx->nextBoost) {
+    mlfqBoost(ctx);
+    ctx->nextBoost = time - time % ctx->boostPeriod + ctx->boostPeriod;
+  }
+}
+
 /**
  * Returns the lowest number cpu core
  * Returns -1 if all cores are busy
  */
-int cpuCoresAvailable() {
-  for (int i = 0; i < cpu.nCores; i++) {
-    if (cpu.jobs[i] == NULL) {
-      return i;
+int cpuCoresAvailable(core_t* cpu) {
+  for (int w = 0; w < cpu->nIdleWords; w++) {
+    if (cpu->idle[w] != 0) {
+      return w * 64 + __builtin_ctzll(cpu->idle[w]);
     }
   }
   return -1;
 }
 
+/**
+ * Works out what the cost model charges a job for being dispatched on a
+ * core: nothing on its first dispatch or when nothing else ran on that core
+ * in between, otherwise a price for how far the core is from its last one.
+ * @param index  the cpu core the job is going on
+ * @param job    the index of the job
+ * @return       the time units to add to the job's remaining time
+ */
+int dispatchCost(scheduler_ctx_t* ctx, int index, int job) {
+  const scheduler_cost_model_t* m = &ctx->costs;
+  int last = ctx->table.lastCore[job];
+  if (last == -1 || (last == index && ctx->cpu.lastJob[index] == job)) {
+    return 0;
+  }
+
+  int distance = 2;
+  if (last == index) {
+    distance = 0;
+  } else if (m->cores_per_socket <= 0 || last / m->cores_per_socket == index / m->cores_per_socket) {
+    distance = 1;
+  }
+  int cost = distance == 0 ? m->switch_cost : distance == 1 ? m->socket_cost : m->numa_cost;
+  if (cost > 0) {
+    ctx->charged[distance]++;
+  }
+  return cost;
+}
+
 /**
  * Attempts to assign a job to a cpu core
  * @param index  the cpu core we are assigning the job to
- * @param job    the job object a cpu core is being handed
- * @return       return job pointer that was added
+ * @param job    the index of the job a cpu core is being handed
+ * @return       return the index of the job that was added
  */
-job_t* cpuCoreAssignJob(int index, job_t* job) {
-  if (cpu.jobs[index] != NULL) {
+int cpuCoreAssignJob(scheduler_ctx_t* ctx, int index, int job) {
+  core_t* cpu = &ctx->cpu;
+  if (cpu->jobs[index] != -1) {
     exit(1); //This shouldn't happen but it is saying the CPU is busy/is used. Made a check before this.
   }
 
-  cpu.jobs[index] = job;
-  job->lastTime = currentTime;
+  STATS_INC(ctx, switches[index]);
+  if (ctx->table.lastCore[job] != -1 && ctx->table.lastCore[job] != index) {
+    ctx->migrations++;
+  }
+  cpu->cost[index] = dispatchCost(ctx, index, job);
+  ctx->table.remainingTime[job] += cpu->cost[index];
+  ctx->table.overhead[job] += cpu->cost[index];
+  ctx->overhead += cpu->cost[index];
+  ctx->table.lastCore[job] = index;
+  if (ctx->curScheme == CFS && ctx->table.vruntime[job] > ctx->minVruntime) {
+    ctx->minVruntime = ctx->table.vruntime[job];
+  }
+  cpu->lastJob[index] = job;
+  cpu->jobs[index] = job;
+  cpu->remaining[index] = ctx->table.remainingTime[job];
+  cpu->lastTime[index] = ctx->currentTime;
+  cpu->idle[index / 64] &= ~(1ULL << (index % 64));
+
+  //The response time is taken at first dispatch, and given back in cpuCoreRemoveJob
+  //if the job leaves again before getting any time
+  if (ctx->table.initTime[job] == -1) {
+    ctx->table.initTime[job] = ctx->currentTime;
+    ctx->totalRespTime += ctx->currentTime - ctx->table.arrivalTime[job];
+    ctx->numResponse++;
+    cpu->fresh[index / 64] |= 1ULL << (index % 64);
+  }
+  if (cpu->ranked) {
+    runningInsert(ctx, index);
+  }
+  ctx->table.lastTime[job] = ctx->currentTime;
   return job;
 }
 
-job_t* cpuCoreRemoveJob(int core_id, int job_number) {
+int cpuCoreRemoveJob(scheduler_ctx_t* ctx, int core_id, int job_number) {
+  core_t* cpu = &ctx->cpu;
   //Not in range of the number of cores we have
-  if (core_id < 0 || core_id >= cpu.nCores ) {
+  if (core_id < 0 || core_id >= cpu->nCores ) {
     exit(1);
   }
 
   //Removing a job a cpu that doesn't have it currently
-  if (cpu.jobs[core_id]->jobNumber != job_number) {
+  if (cpu->jobs[core_id] == -1 || ctx->table.jobNumber[cpu->jobs[core_id]] != job_number) {
     exit(1);
   }
   //----- The above are to catch program
 
-  job_t* job = cpu.jobs[core_id];
-  job->lastTime = -1;
-  cpu.jobs[core_id] = NULL;
-  priqueue_offer(mQueue, job);
+  int job = cpu->jobs[core_id];
+  cpuSyncCore(ctx, core_id);
+  if (ctx->curScheme == CFS) {
+    long long ran = ctx->currentTime - cpu->lastTime[core_id];
+    ctx->table.vruntime[job] += ran * CFS_NICE0_WEIGHT * CFS_VRUNTIME_SCALE / cfsWeight(ctx->table.priority[job]);
+  }
+  if ((cpu->fresh[core_id / 64] >> (core_id % 64) & 1) && cpu->lastTime[core_id] == ctx->currentTime) {
+    ctx->table.initTime[job] = -1;
+    ctx->totalRespTime -= ctx->currentTime - ctx->table.arrivalTime[job];
+    ctx->numResponse--;
+  }
+  ctx->table.lastTime[job] = -1;
+  if (cpu->ranked) {
+    runningRemove(ctx, core_id);
+  }
+  cpu->jobs[core_id] = -1;
+  cpu->idle[core_id / 64] |= 1ULL << (core_id % 64);
+  cpu->fresh[core_id / 64] &= ~(1ULL << (core_id % 64));
   return job;
 }
 
 
-int cpuCorePreempt(job_t* job) {
+int cpuCorePreempt(scheduler_ctx_t* ctx, int job) {
+  core_t* cpu = &ctx->cpu;
   //This shouldn't happen, because there should have been a spot to queue the job up on CPU
-  if (cpuCoresAvailable() != -1) {
+  if (cpuCoresAvailable(cpu) != -1) {
     exit(1);
   }
-
-  //Searches for a valid CPU to preempt, if none found return -1;
-  int prevCompare = 0;
-  int currCompare = 0;
-  int cpuIndex = -1;
-  for (int i = 0; i < cpu.nCores; i++) {
-    prevCompare = compare(job, cpu.jobs[i]);
-    if (prevCompare < currCompare) {
-      currCompare = prevCompare;
-      cpuIndex = i;
-    } else if (prevCompare == currCompare) {
-      if (cpuIndex != -1) {
-        if (cpu.jobs[cpuIndex]->arrivalTime < cpu.jobs[i]->arrivalTime) {
-          cpuIndex = i;
-        }
-      }
-    }
+  STATS_INC(ctx, preemptAttempts);
+
+  //The top of the running heap is the job every other running job beats
+  //(latest arrival among equals), so it is the only preemption candidate.
+  int cpuIndex = cpu->running[0];
+  cpuSyncCore(ctx, cpuIndex);
+  if (compare(ctx, job, cpu->jobs[cpuIndex]) >= 0) {
+    cpuIndex = -1;
   }
 
   //Found a valid CPU to preempt, swap jobs on that core.
   if (cpuIndex >= 0) {
-    cpuCoreRemoveJob(cpuIndex, cpu.jobs[cpuIndex]->jobNumber);
-    cpuCoreAssignJob(cpuIndex, job);
+    STATS_INC(ctx, preemptions);
+    queueJob(ctx, cpuCoreRemoveJob(ctx, cpuIndex, ctx->table.jobNumber[cpu->jobs[cpuIndex]]), cpuIndex);
+    cpuCoreAssignJob(ctx, cpuIndex, job);
   }
 
   return cpuIndex;
 }
 
+/*
+ * The three events, as of ctx->currentTime. The public entry points and
+ * scheduler_submit_batch() move the clock and then call these.
+ */
+
+//A job arrives: returns the core it now runs on, or -1 if it was queued
+int jobArrive(scheduler_ctx_t* ctx, int job_number, int running_time, int priority)
+{
+  job_table_t* t = &ctx->table;
+  if (t->freeList == -1) {
+    STATS_INC(ctx, allocations);
+  }
+  int job = jobAlloc(t);
+  t->jobNumber[job] = job_number;
+  t->arrivalTime[job] = ctx->currentTime;
+  t->runTime[job] = running_time;
+  t->remainingTime[job] = running_time;
+  t->priority[job] = priority;
+  t->initTime[job] = -1;
+  t->lastTime[job] = -1;
+  t->level[job] = 0;
+  t->lastCore[job] = -1;
+  t->overhead[job] = 0;
+  if (ctx->curScheme == CFS) {
+    t->vruntime[job] = ctx->minVruntime;
+    ctx->fairWeight += cfsWeight(priority);
+    ctx->fairRunnable++;
+  }
+
+  int workingCore = cpuCoresAvailable(&ctx->cpu); //Returns the lowest available core
+
+  if (workingCore != -1) {
+    cpuCoreAssignJob(ctx, workingCore, job);
+  } else if (ctx->curScheme == PSJF || ctx->curScheme == PPRI || ctx->curScheme == MLFQ) {
+    workingCore = cpuCorePreempt(ctx, job); //Foreces core to stop to look at current job if applicable
+    if (workingCore == -1) { //If all current jobs on cpu have higher 'priority' at the moment
+      queueJob(ctx, job, arrivalCore(ctx));
+    }
+  } else {
+    queueJob(ctx, job, arrivalCore(ctx));
+  }
+  return workingCore;
+}
+
+//A job finished on core_id: returns the job number the core runs next, or -1
+int jobFinish(scheduler_ctx_t* ctx, int core_id, int job_number)
+{
+  //A running job is never in the ready queue, so there is nothing to unlink
+  job_table_t* t = &ctx->table;
+  int job = cpuCoreRemoveJob(ctx, core_id, job_number);
+
+  //Time spent paying the cost model is neither waiting nor the job's own work
+  ctx->totalWaitTime += (ctx->currentTime - t->arrivalTime[job] - t->runTime[job] - t->overhead[job]);
+  ctx->numWaiting++;
+
+  ctx->totalTurnAroundTime += (ctx->currentTime - t->arrivalTime[job]);
+  ctx->numTurnAround++;
+
+  //Response time is only settled once the job can no longer be given it back, so all
+  //three are recorded here
+  int level = t->priority[job];
+  if (level < 0 || level >= SCHEDULER_PRIORITY_LEVELS) {
+    level = SCHEDULER_PRIORITY_LEVELS;
+  }
+  if (ctx->priorityHists[level] == NULL) {
+    ctx->priorityHists[level] = (time_hist_t*)calloc(SCHEDULER_METRICS, sizeof(time_hist_t));
+  }
+  int times[SCHEDULER_METRICS];
+  times[SCHEDULER_WAITING] = ctx->currentTime - t->arrivalTime[job] - t->runTime[job] - t->overhead[job];
+  times[SCHEDULER_TURNAROUND] = ctx->currentTime - t->arrivalTime[job];
+  times[SCHEDULER_RESPONSE] = t->initTime[job] - t->arrivalTime[job];
+  for (int m = 0; m < SCHEDULER_METRICS; m++) {
+    histAdd(&ctx->hists[m], times[m]);
+    histAdd(&ctx->priorityHists[level][m], times[m]);
+  }
+
+  if (ctx->curScheme == CFS) {
+    ctx->fairWeight -= cfsWeight(t->priority[job]);
+    ctx->fairRunnable--;
+  }
+  jobRelease(t, job);
+  ctx->cpu.lastJob[core_id] = -1;
+
+  int next = -1;
+  job = dequeueJob(ctx, core_id);
+  if (job != -1) {
+    cpuCoreAssignJob(ctx, core_id, job);
+    next = t->jobNumber[job];
+  }
+  return next;
+}
+
+//The quantum of core_id's job expired: returns the job number the core runs next, or -1
+int jobExpire(scheduler_ctx_t* ctx, int core_id)
+{
+  int expired = cpuCoreRemoveJob(ctx, core_id, ctx->table.jobNumber[ctx->cpu.jobs[core_id]]);
+  //MLFQ demotes a job that used up its whole quantum
+  if (ctx->curScheme == MLFQ && ctx->table.level[expired] < ctx->mlfqLevels - 1) {
+    ctx->table.level[expired]++;
+  }
+  queueJob(ctx, expired, core_id);
+
+  int next = -1;
+  int job = dequeueJob(ctx, core_id);
+  if (job != -1) {
+    cpuCoreAssignJob(ctx, core_id, job);
+    next = ctx->table.jobNumber[job];
+  }
+  return next;
+}
+
 /**
   Initalizes the scheduler.
 
@@ -242,16 +1106,39 @@ int cpuCorePreempt(job_t* job) {
 
   @param cores the number of cores that is available by the scheduler. These cores will be known as core(id=0), core(id=1), ..., core(id=cores-1).
   @param scheme  the scheduling scheme that should be used. This value will be one of the six enum values of scheme_t
+  @return the new scheduler, to be released with scheduler_ctx_destroy()
 */
-void scheduler_start_up(int cores, scheme_t scheme)
+scheduler_ctx_t* scheduler_ctx_create(int cores, scheme_t scheme)
 {
-  curScheme = scheme;
-
-  mQueue = (priqueue_t*)malloc(sizeof(priqueue_t));
-  priqueue_init(mQueue, compare);
+  scheduler_ctx_t* ctx = (scheduler_ctx_t*)calloc(1, sizeof(scheduler_ctx_t));
+  ctx->curScheme = scheme;
+
+  //FCFS and RR only ever append in arrival order, so a ring buffer is enough;
+  //schemes that actually order the queue get a heap of packed integer keys,
+  //except PRI and PPRI, which start on O(1) per-priority buckets
+  priqueue_attr_t attr = { .backend = PRIQUEUE_FIFO };
+  ctx->mQueue = (priqueue_t*)malloc(sizeof(priqueue_t));
+  priqueue_init_attr(ctx->mQueue, compareNone, &attr);
+  keyQueue_init(&ctx->keyQueue, 0, STATS_USER(ctx));
+  bucketQueue_init(&ctx->bucketQueue, STATS_USER(ctx));
+  ctx->bucketed = (scheme == PRI || scheme == PPRI);
+  levelQueue_init(&ctx->mlfqQueue, &ctx->table);
+  //CFS re-queues every job at a new vruntime, anywhere in the order, so it needs a real tree
+  priqueue_attr_t treeAttr = { .backend = PRIQUEUE_TREE };
+  ctx->fairQueue = (priqueue_t*)malloc(sizeof(priqueue_t));
+  priqueue_init_user(ctx->fairQueue, compareVruntime, &ctx->table, &treeAttr);
+  scheduler_ctx_set_cfs(ctx, 24, 3);
+  static const int defaultQuanta[] = { 2, 4, 8 };
+  scheduler_ctx_set_mlfq(ctx, 3, defaultQuanta, 100);
+  ctx->table.freeList = -1;
+  jobTableGrow(&ctx->table, 64);
   //Emulate initalization of CPU.
-  cpuInit(&cpu, cores);
-  cpuUpdateTime(0);
+  cpuInit(&ctx->cpu, cores, scheme);
+  cpuUpdateTime(ctx, 0);
+#ifdef SCHED_STATS
+  ctx->stats.switches = (unsigned long long*)calloc(cores, sizeof(unsigned long long));
+#endif
+  return ctx;
 }
 
 
@@ -267,6 +1154,7 @@ void scheduler_start_up(int cores, scheme_t scheme)
   Assumptions:
     - You may assume that every job wil have a unique arrival time.
 
+  @param ctx the scheduler the job arrives at.
   @param job_number a globally unique identification number of the job arriving.
   @param time the current time of the simulator.
   @param running_time the total number of time units this job will run before it will be finished.
@@ -275,40 +1163,14 @@ void scheduler_start_up(int cores, scheme_t scheme)
   @return -1 if no scheduling changes should be made.
 
  */
-int scheduler_new_job(int job_number, int time, int running_time, int priority)
+int scheduler_ctx_new_job(scheduler_ctx_t* ctx, int job_number, int time, int running_time, int priority)
 {
-  cpuUpdateTime(time);
-  job_t* job = (job_t*)malloc(sizeof(job_t));
-  job->jobNumber = job_number;
-  job->arrivalTime = time;
-  job->runTime = running_time;
-  job->remainingTime = running_time;
-  job->priority = priority;
-  job->initTime = -1;
-  job->lastTime = -1;
-
-  int workingCore = cpuCoresAvailable(); //Returns the lowest available core
-  printf("workingCore=%d\n", workingCore);
-  if (cpu.jobs[0] != NULL) {
-    printf("cpu.jobs[0]=%d\n", cpu.jobs[0]->jobNumber);
-  }
-
-  if (workingCore != -1) {
-    cpuCoreAssignJob(workingCore, job);
-    return workingCore;
-  } else if (curScheme == PSJF || curScheme == PPRI) {
-    workingCore = cpuCorePreempt(job); //Foreces core to stop to look at current job if applicable
-    printf("workingCore=%d\n", workingCore);
-    if (workingCore == -1) { //If all current jobs on cpu have higher 'priority' at the moment
-      priqueue_offer(mQueue, job);
-    }
-    return workingCore;
-  } else {
-    priqueue_offer(mQueue, job);
-    printf("returning -1");
-    return -1;
-  }
-}
+  STATS_START(started);
+  cpuUpdateTime(ctx, time);
+  int core = jobArrive(ctx, job_number, running_time, priority);
+  STATS_STOP(ctx, STATS_NEW_JOB, started);
+  return core;
+}
 
 
 /**
@@ -319,60 +1181,261 @@ int scheduler_new_job(int job_number, int time, int running_time, int priority)
   finished job, return the job_number of the job that should be scheduled to
   run on core core_id.
 
+  @param ctx the scheduler the job ran on.
   @param core_id the zero-based index of the core where the job was located.
   @param job_number a globally unique identification number of the job.
   @param time the current time of the simulator.
   @return job_number of the job that should be scheduled to run on core core_id
   @return -1 if core should remain idle.
  */
-int scheduler_job_finished(int core_id, int job_number, int time)
+int scheduler_ctx_job_finished(scheduler_ctx_t* ctx, int core_id, int job_number, int time)
 {
-  cpuUpdateTime(time);
-  job_t* job = cpuCoreRemoveJob(core_id, job_number);
-  priqueue_remove(mQueue, job);
-
-  totalWaitTime += (currentTime - job->arrivalTime - job->runTime);
-  numWaiting++;
-
-  totalTurnAroundTime += (currentTime - job->arrivalTime);
-  numTurnAround++;
-
-  free(job);
-
-  job = priqueue_poll(mQueue);
-  if (job) {
-    cpuCoreAssignJob(core_id, job);
-    return job->jobNumber;
-  }
-
-	return -1;
+  STATS_START(started);
+  cpuUpdateTime(ctx, time);
+  int next = jobFinish(ctx, core_id, job_number);
+  STATS_STOP(ctx, STATS_JOB_FINISHED, started);
+	return next;
 }
 
 
 /**
-  When the scheme is set to RR, called when the quantum timer has expired
+  When the scheme is set to RR, MLFQ or CFS, called when the quantum timer has expired
   on a core.
 
   If any job should be scheduled to run on the core free'd up by
   the quantum expiration, return the job_number of the job that should be
   scheduled to run on core core_id.
 
+  @param ctx the scheduler the core belongs to.
   @param core_id the zero-based index of the core where the quantum has expired.
   @param time the current time of the simulator.
   @return job_number of the job that should be scheduled on core cord_id
   @return -1 if core should remain idle
  */
-int scheduler_quantum_expired(int core_id, int time)
+int scheduler_ctx_quantum_expired(scheduler_ctx_t* ctx, int core_id, int time)
+{
+  STATS_START(started);
+  cpuUpdateTime(ctx, time);
+  int next = jobExpire(ctx, core_id);
+  STATS_STOP(ctx, STATS_QUANTUM_EXPIRED, started);
+	return next;
+}
+
+
+/**
+  Applies every event of one timestamp in a single call, with the same
+  outcome as calling scheduler_job_finished(), scheduler_quantum_expired()
+  and scheduler_new_job() for each in turn.
+
+  The clock is moved once, and jobs that get queued along the way are held
+  back until the next time a core takes a job from the queue, or the end of
+  the batch: the SJF/PSJF heap then takes them all at once, rebuilding
+  bottom-up when that is cheaper. Per-core queues (set_per_core_queues)
+  place each job by the queue lengths of the moment, so they are never held
+  back.
+
+  @param ctx the scheduler the events happen on.
+  @param time the current time of the simulator, the same for every event.
+  @param events the events, in the order they would have been made as calls.
+  @param n the number of events.
+  @param out one decision per event, filled in as the event is applied.
+ */
+void scheduler_ctx_submit_batch(scheduler_ctx_t* ctx, int time, const scheduler_event_t* events, int n, scheduler_decision_t* out)
+{
+  STATS_START(started);
+  cpuUpdateTime(ctx, time);
+  ctx->batching = 1;
+  for (int i = 0; i < n; i++) {
+    const scheduler_event_t* e = &events[i];
+    scheduler_decision_t* d = &out[i];
+    if (e->kind == SCHEDULER_NEW_JOB) {
+      d->core_id = jobArrive(ctx, e->job_number, e->running_time, e->priority);
+      d->job_number = e->job_number;
+    } else {
+      d->core_id = e->core_id;
+      d->job_number = (e->kind == SCHEDULER_JOB_FINISHED) ? jobFinish(ctx, e->core_id, e->job_number) : jobExpire(ctx, e->core_id);
+    }
+    int busy = (d->core_id != -1 && d->job_number != -1);
+    d->cost = busy ? scheduler_ctx_dispatch_cost(ctx, d->core_id) : 0;
+    d->quantum = busy ? scheduler_ctx_quantum(ctx, d->core_id) : -1;
+  }
+  ctx->batching = 0;
+  if (ctx->nPending > 0) {
+    queueFlush(ctx);
+  }
+  STATS_STOP(ctx, STATS_SUBMIT_BATCH, started);
+}
+
+
+/**
+  Configures the MLFQ scheme. A new scheduler starts with 3 levels, quanta
+  of 2, 4 and 8 and a boost every 100 time units.
+
+  Jobs arrive at level 0 and drop a level each time they use up their
+  level's quantum, down to the last level. Lower levels only run when every
+  level above is empty, and a job arriving preempts the running job on the
+  lowest level, if that is below 0. Every boost_period time units every job
+  goes back to level 0.
+
+  Assumptions:
+    - This is called before the first job arrives.
+    - levels is in [1, SCHEDULER_MLFQ_MAX_LEVELS] and each quantum is positive.
+  @param ctx the scheduler to configure.
+  @param levels the number of levels.
+  @param quanta the quantum of each level, top level first.
+  @param boost_period time between boosts, or 0 to never boost.
+ */
+void scheduler_ctx_set_mlfq(scheduler_ctx_t* ctx, int levels, const int* quanta, int boost_period)
+{
+  if (levels < 1 || levels > SCHEDULER_MLFQ_MAX_LEVELS) {
+    exit(1);
+  }
+  ctx->mlfqLevels = levels;
+  memcpy(ctx->mlfqQuanta, quanta, sizeof(int) * levels);
+  ctx->boostPeriod = boost_period > 0 ? boost_period : 0;
+  //The next multiple of the period, which is the period itself at time 0
+  ctx->nextBoost = ctx->boostPeriod ? ctx->currentTime - ctx->currentTime % ctx->boostPeriod + ctx->boostPeriod : 0;
+}
+
+
+/**
+  Gives every core its own ready queue instead of the one shared queue.
+
+  A job that arrives while every core is busy (and preempts nothing) waits
+  on the core with the fewest jobs queued; a preempted or expired job goes
+  back on its own core's queue. A core that needs a job takes one from its
+  own queue, or, when that is empty, steals the best job queued on the
+  busiest core. Each core's queue keeps the scheme's order, but the order
+  is only local: the best waiting job overall can sit behind a worse one
+  on another core.
+
+  Assumptions:
+    - This is called before the first job arrives.
+  @param ctx the scheduler to configure.
+  @param enabled 1 for per-core queues, 0 for the shared queue.
+ */
+void scheduler_ctx_set_per_core_queues(scheduler_ctx_t* ctx, int enabled)
+{
+  if (enabled && !ctx->perCore) {
+    int cores = ctx->cpu.nCores;
+    ctx->local = (keyQueue_t*)malloc(sizeof(keyQueue_t) * cores);
+    for (int i = 0; i < cores; i++) {
+      keyQueue_init(&ctx->local[i], 0, STATS_USER(ctx));
+    }
+    loadInit(&ctx->leastLoaded, cores, 0);
+    loadInit(&ctx->mostLoaded, cores, 1);
+  }
+  ctx->perCore = enabled;
+}
+
+
+/**
+  Reports how much work the ready queues did and how often jobs moved
+  between cores, for comparing per-core queues against the shared one.
+
+  @param ctx the scheduler to report on.
+  @param out filled in with the counts so far.
+ */
+void scheduler_ctx_counters(scheduler_ctx_t* ctx, scheduler_counters_t* out)
+{
+  out->steals = ctx->steals;
+  out->migrations = ctx->migrations;
+  out->queue_ops = ctx->queueOps;
+  out->overhead = ctx->overhead;
+  out->switches = ctx->charged[0];
+  out->socket_migrations = ctx->charged[1];
+  out->numa_migrations = ctx->charged[2];
+}
+
+
+/**
+  Sets what dispatching a job costs, see scheduler_cost_model_t. Without a
+  call every dispatch is free. The cost is added to the job's remaining
+  time, so the caller has to run the job that much longer: it learns how
+  much from scheduler_dispatch_cost() each time a core gets a job.
+
+  Assumptions:
+    - This is called before the first job arrives.
+  @param ctx the scheduler to configure.
+  @param model the costs, copied.
+ */
+void scheduler_ctx_set_cost_model(scheduler_ctx_t* ctx, const scheduler_cost_model_t* model)
+{
+  ctx->costs = *model;
+}
+
+
+/**
+  Returns the time units the cost model charged the job now on a core when
+  it was dispatched there.
+
+  @param ctx the scheduler the core belongs to.
+  @param core_id the zero-based index of the core.
+  @return the time added to the job's run time, 0 when the core is idle
+ */
+int scheduler_ctx_dispatch_cost(scheduler_ctx_t* ctx, int core_id)
+{
+  return ctx->cpu.jobs[core_id] == -1 ? 0 : ctx->cpu.cost[core_id];
+}
+
+
+/**
+  Configures the CFS scheme. A new scheduler starts with a latency of 24
+  and a granularity of 3.
+
+  Jobs wait in a tree ordered by virtual runtime: the time they have run,
+  scaled down by their weight, so a job's priority (read as a nice value)
+  sets its share of the CPU. Arrivals start at the smallest virtual runtime
+  picked so far and never preempt. A dispatched job's slice is its weight's
+  share of latency, or of granularity times the number of runnable jobs
+  once that is longer.
+
+  Assumptions:
+    - This is called before the first job arrives.
+    - latency and granularity are positive.
+  @param ctx the scheduler to configure.
+  @param latency the period every runnable job should get a slice in.
+  @param granularity the shortest slice the period is stretched to keep.
+ */
+void scheduler_ctx_set_cfs(scheduler_ctx_t* ctx, int latency, int granularity)
+{
+  if (latency < 1 || granularity < 1) {
+    exit(1);
+  }
+  ctx->cfsLatency = latency;
+  ctx->cfsGranularity = granularity;
+}
+
+
+/**
+  Returns the quantum the job running on a core is entitled to. The
+  simulator calls this whenever it hands a core a new job under MLFQ or
+  CFS, to know when to call scheduler_quantum_expired().
+
+  @param ctx the scheduler the core belongs to.
+  @param core_id the zero-based index of the core.
+  @return the quantum of the MLFQ level the core's job is on, or the CFS slice it was given
+  @return -1 if the core is idle or the scheme is neither MLFQ nor CFS
+ */
+int scheduler_ctx_quantum(scheduler_ctx_t* ctx, int core_id)
 {
-  cpuUpdateTime(time);
-  cpuCoreRemoveJob(core_id, cpu.jobs[core_id]->jobNumber);
+  int job = ctx->cpu.jobs[core_id];
+  if (job == -1) {
+    return -1;
+  }
+  if (ctx->curScheme == MLFQ) {
+    return ctx->mlfqQuanta[ctx->table.level[job]];
+  }
+  if (ctx->curScheme != CFS) {
+    return -1;
+  }
 
-  job_t* job = priqueue_poll(mQueue);
-  if (job) {
-    cpuCoreAssignJob(core_id, job);
-    return job->jobNumber;
+  long long period = ctx->cfsLatency;
+  if ((long long)ctx->fairRunnable * ctx->cfsGranularity > period) {
+    period = (long long)ctx->fairRunnable * ctx->cfsGranularity;
   }
-	return -1;
+  long long slice = period * cfsWeight(ctx->table.priority[job]) / ctx->fairWeight;
+  return slice > 0 ? (int)slice : 1;
 }
 
 
@@ -381,12 +1444,13 @@ int scheduler_quantum_expired(int core_id, int time)
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param ctx the scheduler to report on.
   @return the average waiting time of all jobs scheduled.
  */
-float scheduler_average_waiting_time()
+float scheduler_ctx_average_waiting_time(scheduler_ctx_t* ctx)
 {
-  if (numWaiting != 0) {
-    return (double)totalWaitTime/numWaiting;
+  if (ctx->numWaiting != 0) {
+    return (double)ctx->totalWaitTime/ctx->numWaiting;
   }
 	return 0.0;
 }
@@ -397,12 +1461,13 @@ float scheduler_average_waiting_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param ctx the scheduler to report on.
   @return the average turnaround time of all jobs scheduled.
  */
-float scheduler_average_turnaround_time()
+float scheduler_ctx_average_turnaround_time(scheduler_ctx_t* ctx)
 {
-  if (numTurnAround != 0) {
-    return (double)totalTurnAroundTime/numTurnAround;
+  if (ctx->numTurnAround != 0) {
+    return (double)ctx->totalTurnAroundTime/ctx->numTurnAround;
   }
 	return 0.0;
 }
@@ -413,33 +1478,89 @@ float scheduler_average_turnaround_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param ctx the scheduler to report on.
   @return the average response time of all jobs scheduled.
  */
-float scheduler_average_response_time()
+float scheduler_ctx_average_response_time(scheduler_ctx_t* ctx)
 {
-  if (numResponse != 0) {
-    return (double)totalRespTime/numResponse;
+  if (ctx->numResponse != 0) {
+    return (double)ctx->totalRespTime/ctx->numResponse;
   }
 	return 0.0;
 }
 
 
+/**
+  Returns the 50th, 90th and 99th percentiles and the maximum of one of the
+  per-job times, over every job that has finished so far.
+
+  The percentiles come from a fixed-size histogram and are within about 3%
+  of the exact value; the maximum is exact.
+  @param ctx the scheduler to report on.
+  @param metric which per-job time to report.
+  @param priority only count jobs of this priority, in [0, SCHEDULER_PRIORITY_LEVELS); or SCHEDULER_ALL_PRIORITIES, or SCHEDULER_OTHER_PRIORITIES for every job outside that range.
+  @param out filled in with the result, all zeros when no job matched.
+  @return the number of jobs counted.
+ */
+long long scheduler_ctx_percentiles(scheduler_ctx_t* ctx, scheduler_metric_t metric, int priority, scheduler_percentiles_t* out)
+{
+  memset(out, 0, sizeof(*out));
+  const time_hist_t* h = NULL;
+  if (priority == SCHEDULER_ALL_PRIORITIES) {
+    h = &ctx->hists[metric];
+  } else if (priority == SCHEDULER_OTHER_PRIORITIES) {
+    h = ctx->priorityHists[SCHEDULER_PRIORITY_LEVELS] ? &ctx->priorityHists[SCHEDULER_PRIORITY_LEVELS][metric] : NULL;
+  } else if (priority >= 0 && priority < SCHEDULER_PRIORITY_LEVELS && ctx->priorityHists[priority]) {
+    h = &ctx->priorityHists[priority][metric];
+  }
+
+  if (h == NULL || h->count == 0) {
+    return 0;
+  }
+  out->count = h->count;
+  out->p50 = histPercentile(h, 0.50);
+  out->p90 = histPercentile(h, 0.90);
+  out->p99 = histPercentile(h, 0.99);
+  out->max = h->max;
+  return h->count;
+}
+
+
 /**
   Free any memory associated with your scheduler.
 
   Assumptions:
-    - This function will be the last function called in your library.
+    - This function will be the last function called on ctx.
+  @param ctx the scheduler to free.
 */
-void scheduler_clean_up()
+void scheduler_ctx_destroy(scheduler_ctx_t* ctx)
 {
-  void* job = NULL;
-  do {
-    job = priqueue_poll(mQueue);
-    free((job_t*) job);
-  } while(job != NULL);
-  free(cpu.jobs);
-  priqueue_destroy(mQueue);
-  free(mQueue);
+  //Every job lives in the table, so it goes in one piece
+  jobTableDestroy(&ctx->table);
+  cpuDestroy(&ctx->cpu);
+  keyQueue_destroy(&ctx->keyQueue);
+  bucketQueue_destroy(&ctx->bucketQueue);
+  levelQueue_destroy(&ctx->mlfqQueue);
+  if (ctx->local) {
+    for (int i = 0; i < ctx->cpu.nCores; i++) {
+      keyQueue_destroy(&ctx->local[i]);
+    }
+    free(ctx->local);
+    loadDestroy(&ctx->leastLoaded);
+    loadDestroy(&ctx->mostLoaded);
+  }
+  priqueue_destroy(ctx->mQueue);
+  free(ctx->mQueue);
+  priqueue_destroy(ctx->fairQueue);
+  free(ctx->fairQueue);
+  free(ctx->pending);
+  for (int i = 0; i <= SCHEDULER_PRIORITY_LEVELS; i++) {
+    free(ctx->priorityHists[i]);
+  }
+#ifdef SCHED_STATS
+  free(ctx->stats.switches);
+#endif
+  free(ctx);
 }
 
 
@@ -453,8 +1574,498 @@ void scheduler_clean_up()
 
   This function is not required and will not be graded. You may leave it
   blank if you do not find it useful.
+  @param ctx the scheduler whose queue to print.
  */
-void scheduler_show_queue()
+void scheduler_ctx_show_queue(scheduler_ctx_t* ctx)
 {
   //Woof
 }
+
+
+#ifdef SCHED_STATS
+//Adds one ready queue's counters into sum
+static void statsAddQueue(priqueue_stats_t* sum, const priqueue_stats_t* qs) {
+  sum->comparisons += qs->comparisons;
+  sum->traversed += qs->traversed;
+  sum->allocations += qs->allocations;
+}
+#endif
+
+/**
+  Prints the counters and entry point latency histograms gathered so far.
+
+  They are only collected when the scheduler is built with -DSCHED_STATS
+  (make STATS=1); otherwise this just says so.
+  @param ctx the scheduler to report on.
+ */
+void scheduler_ctx_dump_stats(scheduler_ctx_t* ctx)
+{
+#ifdef SCHED_STATS
+  const scheduler_stats_t* st = &ctx->stats;
+
+  //Summed over every ready queue, only the ones the scheme uses count anything
+  priqueue_stats_t qs = { 0, 0, 0 };
+  statsAddQueue(&qs, &ctx->mQueue->stats);
+  statsAddQueue(&qs, &ctx->keyQueue.stats);
+  statsAddQueue(&qs, &ctx->bucketQueue.stats);
+  statsAddQueue(&qs, &ctx->mlfqQueue.stats);
+  statsAddQueue(&qs, &ctx->fairQueue->stats);
+  for (int i = 0; ctx->local && i < ctx->cpu.nCores; i++) {
+    statsAddQueue(&qs, &ctx->local[i].stats);
+  }
+
+  printf("Scheduler statistics:\n");
+  printf("  Job comparisons: %llu\n", st->comparisons);
+  printf("  Queue comparisons: %llu\n", qs.comparisons);
+  printf("  Queue elements walked past on offer: %llu\n", qs.traversed);
+  printf("  Queue allocations on offer: %llu\n", qs.allocations);
+  printf("  Job table allocations: %llu\n", st->allocations);
+  printf("  Preemptions: %llu of %llu attempted\n", st->preemptions, st->preemptAttempts);
+  printf("  Context switches per core:");
+  for (int i = 0; i < ctx->cpu.nCores; i++) {
+    printf(" %d:%llu", i, st->switches[i]);
+  }
+  printf("\n");
+
+  for (int e = 0; e < STATS_ENTRY_POINTS; e++) {
+    const stats_timer_t* timer = &st->timers[e];
+    if (timer->calls == 0) {
+      continue;
+    }
+    printf("  %s: %llu calls, mean %.1f ns, max %llu ns\n", statsEntryNames[e],
+           timer->calls, (double)timer->totalNs / timer->calls, timer->maxNs);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+      if (timer->buckets[b] != 0) {
+        printf("    [%llu, %llu) ns: %llu\n", b ? 1ULL << b : 0, 2ULL << b, timer->buckets[b]);
+      }
+    }
+  }
+#else
+  printf("Scheduler statistics are not compiled in (rebuild with make STATS=1).\n");
+#endif
+}
+
+
+/*
+ * Snapshots. Fields are written in native byte order, just as the scheduler
+ * keeps them, so a snapshot is meant to be read back by the same build.
+ */
+#define SNAPSHOT_MAGIC   "SCHEDCTX"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CONFIG  12
+
+static inline int snapWrite(FILE* file, const void* data, size_t size, size_t count) {
+  return count == 0 || fwrite(data, size, count, file) == count;
+}
+
+static inline int snapRead(FILE* file, void* data, size_t size, size_t count) {
+  return count == 0 || fread(data, size, count, file) == count;
+}
+
+//Empties the shared queue into jobs, head first, and queues them again in
+//that order, which leaves ties as they were. Returns how many there were.
+int queueDrain(scheduler_ctx_t* ctx, int* jobs) {
+  int n = 0, job;
+  while ((job = queuePoll(ctx)) != -1) {
+    jobs[n++] = job;
+  }
+  for (int i = 0; i < n; i++) {
+    queueOffer(ctx, jobs[i]);
+  }
+  return n;
+}
+
+//The same for one core's own queue. A waiting job's key never changes, so
+//jobKey() gives back the one it had.
+int localDrain(scheduler_ctx_t* ctx, int core, int* jobs) {
+  int n = 0;
+  job_key_t entry;
+  while (keyQueue_poll(&ctx->local[core], &entry)) {
+    jobs[n++] = entry.job;
+  }
+  for (int i = 0; i < n; i++) {
+    job_key_t again = { jobKey(ctx, jobs[i]), jobs[i] };
+    keyQueue_offer(&ctx->local[core], again);
+  }
+  return n;
+}
+
+static int compareEntries(const void* a, const void* b) {
+  uint64_t x = ((const job_key_t*)a)->key, y = ((const job_key_t*)b)->key;
+  return (x > y) - (x < y);
+}
+
+//Sorts jobs by arrival time, keeping the given order among equal arrivals
+void sortByArrival(const job_table_t* t, int* jobs, int n) {
+  job_key_t* entries = (job_key_t*)malloc(sizeof(job_key_t) * (n + 1));
+  for (int i = 0; i < n; i++) {
+    entries[i].key = packKey(t->arrivalTime[jobs[i]], i);
+    entries[i].job = jobs[i];
+  }
+  qsort(entries, n, sizeof(job_key_t), compareEntries);
+  for (int i = 0; i < n; i++) {
+    jobs[i] = entries[i].job;
+  }
+  free(entries);
+}
+
+//The int columns of the job table, in snapshot order
+static inline void jobTableColumns(job_table_t* t, int** columns) {
+  int* all[] = { t->jobNumber, t->arrivalTime, t->runTime, t->remainingTime, t->priority, t->initTime,
+                 t->lastTime, t->level, t->lastCore, t->overhead, t->nextFree };
+  memcpy(columns, all, sizeof(all));
+}
+#define JOB_TABLE_COLUMNS 11
+
+
+/**
+  Writes everything the scheduler knows to a snapshot, for
+  scheduler_ctx_load() to carry on from: its configuration, every job it
+  holds, what each core runs, the order of the ready queues, the counters and
+  the accumulated times and percentiles. Statistics gathered under
+  -DSCHED_STATS are left out.
+
+  Assumptions:
+    - This is not called from inside scheduler_submit_batch().
+  @param ctx the scheduler to save, which is left as it was.
+  @param file where to write, from its current position.
+  @return 1 on success, 0 if writing failed
+ */
+int scheduler_ctx_save(scheduler_ctx_t* ctx, FILE* file)
+{
+  job_table_t* t = &ctx->table;
+  core_t* cpu = &ctx->cpu;
+  if (ctx->nPending > 0) {
+    queueFlush(ctx);
+  }
+
+  int version = SNAPSHOT_VERSION;
+  int config[SNAPSHOT_CONFIG] = { cpu->nCores, ctx->curScheme, ctx->perCore, ctx->bucketed, ctx->mlfqLevels, ctx->boostPeriod,
+                                  ctx->nextBoost, ctx->cfsLatency, ctx->cfsGranularity, ctx->currentTime, t->capacity, t->freeList };
+  long long counts[] = { ctx->minVruntime, ctx->steals, ctx->migrations, ctx->queueOps, ctx->overhead,
+                         ctx->charged[0], ctx->charged[1], ctx->charged[2] };
+  double totals[] = { ctx->totalWaitTime, ctx->totalRespTime, ctx->totalTurnAroundTime };
+  int numbers[] = { ctx->numWaiting, ctx->numResponse, ctx->numTurnAround };
+  int ok = snapWrite(file, SNAPSHOT_MAGIC, 8, 1) && snapWrite(file, &version, sizeof(int), 1) &&
+           snapWrite(file, config, sizeof(int), SNAPSHOT_CONFIG) &&
+           snapWrite(file, ctx->mlfqQuanta, sizeof(int), SCHEDULER_MLFQ_MAX_LEVELS) &&
+           snapWrite(file, &ctx->costs, sizeof(ctx->costs), 1) &&
+           snapWrite(file, counts, sizeof(counts), 1) && snapWrite(file, totals, sizeof(totals), 1) &&
+           snapWrite(file, numbers, sizeof(numbers), 1) && snapWrite(file, ctx->hists, sizeof(ctx->hists), 1);
+  for (int i = 0; ok && i <= SCHEDULER_PRIORITY_LEVELS; i++) {
+    int present = (ctx->priorityHists[i] != NULL);
+    ok = snapWrite(file, &present, sizeof(int), 1) &&
+         (!present || snapWrite(file, ctx->priorityHists[i], sizeof(time_hist_t), SCHEDULER_METRICS));
+  }
+
+  int* columns[JOB_TABLE_COLUMNS];
+  jobTableColumns(t, columns);
+  for (int c = 0; ok && c < JOB_TABLE_COLUMNS; c++) {
+    ok = snapWrite(file, columns[c], sizeof(int), t->capacity);
+  }
+  ok = ok && snapWrite(file, t->vruntime, sizeof(long long), t->capacity) &&
+       snapWrite(file, cpu->jobs, sizeof(int), cpu->nCores) && snapWrite(file, cpu->remaining, sizeof(int), cpu->nCores) &&
+       snapWrite(file, cpu->lastTime, sizeof(int), cpu->nCores) && snapWrite(file, cpu->fresh, sizeof(unsigned long long), cpu->nIdleWords) &&
+       snapWrite(file, cpu->lastJob, sizeof(int), cpu->nCores) && snapWrite(file, cpu->cost, sizeof(int), cpu->nCores);
+
+  //Queues are saved as the order jobs would leave them in, whatever structure holds them
+  int* order = (int*)malloc(sizeof(int) * t->capacity);
+  for (int c = 0; ok && c < (ctx->perCore ? cpu->nCores : 1); c++) {
+    int n = ctx->perCore ? localDrain(ctx, c, order) : queueDrain(ctx, order);
+    ok = snapWrite(file, &n, sizeof(int), 1) && snapWrite(file, order, sizeof(int), n);
+  }
+  free(order);
+  return ok;
+}
+
+
+/**
+  Creates a scheduler from a snapshot written by scheduler_ctx_save(), in
+  the state it was saved in. The scheme may differ from the saved one, to
+  try several schemes from the same point. The waiting jobs are then queued
+  again in the new scheme's order (arrival order for FCFS and RR), and
+  running jobs keep their cores until the new scheme takes them off.
+  Switching to MLFQ puts every job on level 0, and switching to CFS gives
+  every job a virtual runtime of 0. The saved configuration (MLFQ, CFS,
+  cost model, per-core queues) comes back with it, and the setters can
+  still change it.
+
+  @param file where to read, from its current position.
+  @param scheme the scheme to carry on with.
+  @return the scheduler, to be released with scheduler_ctx_destroy()
+  @return NULL if the file does not hold a valid snapshot
+ */
+scheduler_ctx_t* scheduler_ctx_load(FILE* file, scheme_t scheme)
+{
+  char magic[8];
+  int version, config[SNAPSHOT_CONFIG];
+  if (!snapRead(file, magic, 8, 1) || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+      !snapRead(file, &version, sizeof(int), 1) || version != SNAPSHOT_VERSION ||
+      !snapRead(file, config, sizeof(int), SNAPSHOT_CONFIG)) {
+    return NULL;
+  }
+  int cores = config[0], saved = config[1], capacity = config[10];
+  if (cores < 1 || saved < FCFS || saved > CFS || config[4] < 1 || config[4] > SCHEDULER_MLFQ_MAX_LEVELS ||
+      config[7] < 1 || config[8] < 1 || capacity < 1 || config[11] < -1 || config[11] >= capacity) {
+    return NULL;
+  }
+
+  scheduler_ctx_t* ctx = scheduler_ctx_create(cores, scheme);
+  job_table_t* t = &ctx->table;
+  core_t* cpu = &ctx->cpu;
+  ctx->currentTime = config[9];
+  ctx->mlfqLevels = config[4];
+  ctx->boostPeriod = config[5];
+  ctx->nextBoost = config[6];
+  ctx->cfsLatency = config[7];
+  ctx->cfsGranularity = config[8];
+  if (saved == (int)scheme) {
+    ctx->bucketed = config[3];
+  }
+
+  long long counts[8];
+  double totals[3];
+  int numbers[3];
+  int ok = snapRead(file, ctx->mlfqQuanta, sizeof(int), SCHEDULER_MLFQ_MAX_LEVELS) &&
+           snapRead(file, &ctx->costs, sizeof(ctx->costs), 1) &&
+           snapRead(file, counts, sizeof(counts), 1) && snapRead(file, totals, sizeof(totals), 1) &&
+           snapRead(file, numbers, sizeof(numbers), 1) && snapRead(file, ctx->hists, sizeof(ctx->hists), 1);
+  ctx->minVruntime = counts[0];
+  ctx->steals = counts[1];
+  ctx->migrations = counts[2];
+  ctx->queueOps = counts[3];
+  ctx->overhead = counts[4];
+  memcpy(ctx->charged, &counts[5], sizeof(ctx->charged));
+  ctx->totalWaitTime = totals[0];
+  ctx->totalRespTime = totals[1];
+  ctx->totalTurnAroundTime = totals[2];
+  ctx->numWaiting = numbers[0];
+  ctx->numResponse = numbers[1];
+  ctx->numTurnAround = numbers[2];
+  for (int i = 0; ok && i <= SCHEDULER_PRIORITY_LEVELS; i++) {
+    int present;
+    ok = snapRead(file, &present, sizeof(int), 1);
+    if (ok && present) {
+      ctx->priorityHists[i] = (time_hist_t*)calloc(SCHEDULER_METRICS, sizeof(time_hist_t));
+      ok = snapRead(file, ctx->priorityHists[i], sizeof(time_hist_t), SCHEDULER_METRICS);
+    }
+  }
+
+  //The table comes back at its saved size with the same free list, so every job keeps its index
+  jobTableDestroy(t);
+  memset(t, 0, sizeof(*t));
+  t->freeList = -1;
+  jobTableGrow(t, capacity);
+  t->freeList = config[11];
+  int* columns[JOB_TABLE_COLUMNS];
+  jobTableColumns(t, columns);
+  for (int c = 0; ok && c < JOB_TABLE_COLUMNS; c++) {
+    ok = snapRead(file, columns[c], sizeof(int), capacity);
+  }
+  ok = ok && snapRead(file, t->vruntime, sizeof(long long), capacity) &&
+       snapRead(file, cpu->jobs, sizeof(int), cores) && snapRead(file, cpu->remaining, sizeof(int), cores) &&
+       snapRead(file, cpu->lastTime, sizeof(int), cores) && snapRead(file, cpu->fresh, sizeof(unsigned long long), cpu->nIdleWords) &&
+       snapRead(file, cpu->lastJob, sizeof(int), cores) && snapRead(file, cpu->cost, sizeof(int), cores);
+
+  //Walk the free list to find the jobs still alive, each of which must then run on one core or wait in one queue
+  enum { SNAP_FREE, SNAP_ALIVE, SNAP_RUNNING, SNAP_QUEUED };
+  char* live = (char*)malloc(capacity);
+  memset(live, SNAP_ALIVE, capacity);
+  //Each entry is checked before its link is followed, so a corrupt list stops the walk in bounds
+  for (int job = t->freeList, steps = 0; ok && job != -1; steps++) {
+    ok = (job >= 0 && job < capacity && steps < capacity && live[job] == SNAP_ALIVE);
+    if (ok) {
+      live[job] = SNAP_FREE;
+      job = t->nextFree[job];
+    }
+  }
+  for (int i = 0; ok && i < cores; i++) {
+    ok = (cpu->jobs[i] >= -1 && cpu->jobs[i] < capacity && (cpu->jobs[i] == -1 || live[cpu->jobs[i]] == SNAP_ALIVE) &&
+          cpu->lastJob[i] >= -1 && cpu->lastJob[i] < capacity);
+    if (ok && cpu->jobs[i] != -1) {
+      live[cpu->jobs[i]] = SNAP_RUNNING;
+    }
+  }
+
+  if (ok && scheme == MLFQ && saved != MLFQ) {
+    for (int job = 0; job < capacity; job++) {
+      t->level[job] = 0;
+    }
+    ctx->nextBoost = ctx->boostPeriod ? ctx->currentTime - ctx->currentTime % ctx->boostPeriod + ctx->boostPeriod : 0;
+  }
+  if (ok && scheme == CFS) {
+    if (saved != CFS) {
+      memset(t->vruntime, 0, sizeof(long long) * capacity);
+      ctx->minVruntime = 0;
+    }
+    for (int job = 0; job < capacity; job++) {
+      if (live[job] != SNAP_FREE) {
+        ctx->fairWeight += cfsWeight(t->priority[job]);
+        ctx->fairRunnable++;
+      }
+    }
+  }
+
+  for (int i = 0; ok && i < cores; i++) {
+    if (cpu->jobs[i] != -1) {
+      cpu->idle[i / 64] &= ~(1ULL << (i % 64));
+      if (cpu->ranked) {
+        runningInsert(ctx, i);
+      }
+    }
+  }
+
+  if (ok && config[2]) {
+    scheduler_ctx_set_per_core_queues(ctx, 1);
+  }
+  int* order = (int*)malloc(sizeof(int) * capacity);
+  for (int c = 0; ok && c < (ctx->perCore ? cores : 1); c++) {
+    int n;
+    ok = snapRead(file, &n, sizeof(int), 1) && n >= 0 && n <= capacity && snapRead(file, order, sizeof(int), n);
+    for (int i = 0; ok && i < n; i++) {
+      ok = (order[i] >= 0 && order[i] < capacity && live[order[i]] == SNAP_ALIVE);
+      if (ok) {
+        live[order[i]] = SNAP_QUEUED;
+      }
+    }
+    //The FIFO keeps whatever order it is given, so a queue from another scheme is put in arrival order first
+    if (ok && saved != (int)scheme && (scheme == FCFS || scheme == RR)) {
+      sortByArrival(t, order, n);
+    }
+    for (int i = 0; ok && i < n; i++) {
+      if (ctx->perCore) {
+        localOffer(ctx, c, order[i]);
+      } else {
+        queueOffer(ctx, order[i]);
+      }
+    }
+  }
+  free(order);
+  for (int job = 0; ok && job < capacity; job++) {
+    ok = (live[job] != SNAP_ALIVE);
+  }
+  free(live);
+
+  if (!ok) {
+    scheduler_ctx_destroy(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+
+/*
+ * The original single-instance API, kept as a thin layer over defaultCtx.
+ */
+
+void scheduler_start_up(int cores, scheme_t scheme)
+{
+  defaultCtx = scheduler_ctx_create(cores, scheme);
+}
+
+int scheduler_new_job(int job_number, int time, int running_time, int priority)
+{
+  return scheduler_ctx_new_job(defaultCtx, job_number, time, running_time, priority);
+}
+
+int scheduler_job_finished(int core_id, int job_number, int time)
+{
+  return scheduler_ctx_job_finished(defaultCtx, core_id, job_number, time);
+}
+
+int scheduler_quantum_expired(int core_id, int time)
+{
+  return scheduler_ctx_quantum_expired(defaultCtx, core_id, time);
+}
+
+void scheduler_submit_batch(int time, const scheduler_event_t* events, int n, scheduler_decision_t* out)
+{
+  scheduler_ctx_submit_batch(defaultCtx, time, events, n, out);
+}
+
+void scheduler_set_mlfq(int levels, const int* quanta, int boost_period)
+{
+  scheduler_ctx_set_mlfq(defaultCtx, levels, quanta, boost_period);
+}
+
+void scheduler_set_cfs(int latency, int granularity)
+{
+  scheduler_ctx_set_cfs(defaultCtx, latency, granularity);
+}
+
+int scheduler_quantum(int core_id)
+{
+  return scheduler_ctx_quantum(defaultCtx, core_id);
+}
+
+void scheduler_set_per_core_queues(int enabled)
+{
+  scheduler_ctx_set_per_core_queues(defaultCtx, enabled);
+}
+
+void scheduler_counters(scheduler_counters_t* out)
+{
+  scheduler_ctx_counters(defaultCtx, out);
+}
+
+void scheduler_set_cost_model(const scheduler_cost_model_t* model)
+{
+  scheduler_ctx_set_cost_model(defaultCtx, model);
+}
+
+int scheduler_dispatch_cost(int core_id)
+{
+  return scheduler_ctx_dispatch_cost(defaultCtx, core_id);
+}
+
+float scheduler_average_waiting_time()
+{
+  return scheduler_ctx_average_waiting_time(defaultCtx);
+}
+
+float scheduler_average_turnaround_time()
+{
+  return scheduler_ctx_average_turnaround_time(defaultCtx);
+}
+
+float scheduler_average_response_time()
+{
+  return scheduler_ctx_average_response_time(defaultCtx);
+}
+
+long long scheduler_percentiles(scheduler_metric_t metric, int priority, scheduler_percentiles_t* out)
+{
+  return scheduler_ctx_percentiles(defaultCtx, metric, priority, out);
+}
+
+void scheduler_clean_up()
+{
+  scheduler_ctx_destroy(defaultCtx);
+  defaultCtx = NULL;
+}
+
+void scheduler_show_queue()
+{
+  scheduler_ctx_show_queue(defaultCtx);
+}
+
+void scheduler_dump_stats()
+{
+  scheduler_ctx_dump_stats(defaultCtx);
+}
+
+int scheduler_save(FILE* file)
+{
+  return scheduler_ctx_save(defaultCtx, file);
+}
+
+//Takes the place of scheduler_start_up(), leaving the shared instance alone on failure
+int scheduler_restore(FILE* file, scheme_t scheme)
+{
+  scheduler_ctx_t* ctx = scheduler_ctx_load(file, scheme);
+  if (ctx == NULL) {
+    return 0;
+  }
+  defaultCtx = ctx;
+  return 1;
+}
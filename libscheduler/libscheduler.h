@@ -4,20 +4,138 @@
 #ifndef LIBSCHEDULER_H_
 #define LIBSCHEDULER_H_
 
+#include <limits.h>
+#include <stdio.h>
+
 /**
   Constants which represent the different scheduling algorithms
 */
-typedef enum {FCFS = 0, SJF, PSJF, PRI, PPRI, RR} scheme_t;
+typedef enum {FCFS = 0, SJF, PSJF, PRI, PPRI, RR, MLFQ, CFS} scheme_t;
+
+/**
+  Per-job times the scheduler keeps percentiles of
+*/
+typedef enum {SCHEDULER_WAITING = 0, SCHEDULER_TURNAROUND, SCHEDULER_RESPONSE, SCHEDULER_METRICS} scheduler_metric_t;
+
+/**
+  Tail of one metric, as filled in by scheduler_percentiles()
+*/
+typedef struct _scheduler_percentiles_t {
+  long long count; ///< jobs counted
+  float p50;
+  float p90;
+  float p99;
+  int max;         ///< exact; the percentiles are within about 3%
+} scheduler_percentiles_t;
+
+/**
+  What happened at one timestamp, as handed to scheduler_submit_batch()
+*/
+typedef enum {SCHEDULER_JOB_FINISHED = 0, SCHEDULER_QUANTUM_EXPIRED, SCHEDULER_NEW_JOB} scheduler_event_kind_t;
+
+typedef struct _scheduler_event_t {
+  scheduler_event_kind_t kind;
+  int core_id;      ///< finished and quantum expired events
+  int job_number;   ///< finished and new job events
+  int running_time; ///< new job events
+  int priority;     ///< new job events
+} scheduler_event_t;
+
+/**
+  The outcome of one batched event: core_id now runs job_number. A finished
+  or expired event with nothing to run next has job_number -1, and a new job
+  that was queued has core_id -1.
+*/
+typedef struct _scheduler_decision_t {
+  int core_id;
+  int job_number;
+  int cost;         ///< what the cost model charged the dispatch, see scheduler_dispatch_cost()
+  int quantum;      ///< the dispatched job's quantum, see scheduler_quantum()
+} scheduler_decision_t;
+
+/**
+  Queue and migration counts, as filled in by scheduler_counters()
+*/
+typedef struct _scheduler_counters_t {
+  long long steals;     ///< jobs a core took from another core's queue
+  long long migrations; ///< dispatches onto a different core than the job last ran on
+  long long queue_ops;  ///< ready queue offers and polls
+  long long overhead;   ///< time units charged by the cost model
+  long long switches;   ///< dispatches charged the same-core context switch cost
+  long long socket_migrations; ///< dispatches charged the same-socket cost
+  long long numa_migrations;   ///< dispatches charged the cross-socket cost
+} scheduler_counters_t;
+
+/**
+  What it costs a job, in time units added to its remaining time, to be
+  dispatched again after it was taken off a core. A zeroed struct (the
+  default) makes every dispatch free.
+*/
+typedef struct _scheduler_cost_model_t {
+  int switch_cost;      ///< back on the core it last ran on, after another job ran there
+  int socket_cost;      ///< onto another core of the same socket
+  int numa_cost;        ///< onto a core of another socket
+  int cores_per_socket; ///< cores [0, n) are socket 0, [n, 2n) socket 1...; 0 puts every core on one socket
+  int affinity_window;  ///< FCFS/RR: queued jobs to look through for one that last ran on the core, 0 for strict FIFO
+} scheduler_cost_model_t;
+
+#define SCHEDULER_MLFQ_MAX_LEVELS  64      ///< most levels scheduler_set_mlfq() accepts
+#define SCHEDULER_PRIORITY_LEVELS  256     ///< priorities [0, this) get their own breakdown
+#define SCHEDULER_ALL_PRIORITIES   INT_MIN ///< every job, whatever its priority
+#define SCHEDULER_OTHER_PRIORITIES INT_MAX ///< jobs with a priority outside [0, SCHEDULER_PRIORITY_LEVELS)
 
 void  scheduler_start_up               (int cores, scheme_t scheme);
 int   scheduler_new_job                (int job_number, int time, int running_time, int priority);
 int   scheduler_job_finished           (int core_id, int job_number, int time);
 int   scheduler_quantum_expired        (int core_id, int time);
+void  scheduler_submit_batch           (int time, const scheduler_event_t *events, int n, scheduler_decision_t *out);
+void  scheduler_set_mlfq               (int levels, const int *quanta, int boost_period);
+void  scheduler_set_cfs                (int latency, int granularity);
+int   scheduler_quantum                (int core_id);
+void  scheduler_set_per_core_queues    (int enabled);
+void  scheduler_counters               (scheduler_counters_t *out);
+void  scheduler_set_cost_model         (const scheduler_cost_model_t *model);
+int   scheduler_dispatch_cost          (int core_id);
 float scheduler_average_turnaround_time();
 float scheduler_average_waiting_time   ();
 float scheduler_average_response_time  ();
+long long scheduler_percentiles        (scheduler_metric_t metric, int priority, scheduler_percentiles_t *out);
 void  scheduler_clean_up               ();
 
 void  scheduler_show_queue             ();
+void  scheduler_dump_stats             ();
+
+int   scheduler_save                   (FILE *file);
+int   scheduler_restore                (FILE *file, scheme_t scheme);
+
+/**
+  An independent scheduler instance. The functions above all act on one
+  shared instance; these take it explicitly, so a process can run several.
+*/
+typedef struct _scheduler_ctx_t scheduler_ctx_t;
+
+scheduler_ctx_t* scheduler_ctx_create           (int cores, scheme_t scheme);
+int   scheduler_ctx_new_job                (scheduler_ctx_t *ctx, int job_number, int time, int running_time, int priority);
+int   scheduler_ctx_job_finished           (scheduler_ctx_t *ctx, int core_id, int job_number, int time);
+int   scheduler_ctx_quantum_expired        (scheduler_ctx_t *ctx, int core_id, int time);
+void  scheduler_ctx_submit_batch           (scheduler_ctx_t *ctx, int time, const scheduler_event_t *events, int n, scheduler_decision_t *out);
+void  scheduler_ctx_set_mlfq               (scheduler_ctx_t *ctx, int levels, const int *quanta, int boost_period);
+void  scheduler_ctx_set_cfs                (scheduler_ctx_t *ctx, int latency, int granularity);
+int   scheduler_ctx_quantum                (scheduler_ctx_t *ctx, int core_id);
+void  scheduler_ctx_set_per_core_queues    (scheduler_ctx_t *ctx, int enabled);
+void  scheduler_ctx_counters               (scheduler_ctx_t *ctx, scheduler_counters_t *out);
+void  scheduler_ctx_set_cost_model         (scheduler_ctx_t *ctx, const scheduler_cost_model_t *model);
+int   scheduler_ctx_dispatch_cost          (scheduler_ctx_t *ctx, int core_id);
+float scheduler_ctx_average_turnaround_time(scheduler_ctx_t *ctx);
+float scheduler_ctx_average_waiting_time   (scheduler_ctx_t *ctx);
+float scheduler_ctx_average_response_time  (scheduler_ctx_t *ctx);
+long long scheduler_ctx_percentiles        (scheduler_ctx_t *ctx, scheduler_metric_t metric, int priority, scheduler_percentiles_t *out);
+void  scheduler_ctx_destroy                (scheduler_ctx_t *ctx);
+
+void  scheduler_ctx_show_queue             (scheduler_ctx_t *ctx);
+void  scheduler_ctx_dump_stats             (scheduler_ctx_t *ctx);
+
+int   scheduler_ctx_save                   (scheduler_ctx_t *ctx, FILE *file);
+scheduler_ctx_t* scheduler_ctx_load             (FILE *file, scheme_t scheme);
 
 #endif /* LIBSCHEDULER_H_ */
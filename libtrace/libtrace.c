@@ -0,0 +1,601 @@
+/** @file libtrace.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libtrace.h"
+
+/*
+ * atoi() without the locale and errno overhead: optional leading white
+ * space and sign, then digits up to the first non-digit.
+ */
+static int parseInt(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) {
+		p++;
+	}
+
+	int negative = 0;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	unsigned int value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (unsigned int)(*p - '0');
+		p++;
+	}
+	return negative ? -(int)value : (int)value;
+}
+
+/*
+ * Finds the next comma-separated field in [*p, end), skipping empty fields
+ * the way strtok() does. Returns NULL when the line has no fields left.
+ */
+static const char* nextField(const char **p, const char *end, const char **fieldEnd)
+{
+	const char *start = *p;
+	while (start < end && *start == ',') {
+		start++;
+	}
+	if (start == end) {
+		*p = end;
+		return NULL;
+	}
+
+	const char *stop = memchr(start, ',', end - start);
+	if (stop == NULL) {
+		stop = end;
+	}
+	*fieldEnd = stop;
+	*p = stop;
+	return start;
+}
+
+/*
+ * A job can be simulated if it arrives at time 0 or later and runs for some
+ * time.
+ */
+static int validJob(const trace_job_t *job)
+{
+	return job->arrival_time >= 0 && job->run_time > 0;
+}
+
+/*
+ * Parses one "arrival,run time,priority" line held in [p, lineEnd), newline
+ * included. Returns 0 if the line is illegal.
+ */
+static int parseLine(const char *p, const char *lineEnd, trace_job_t *job)
+{
+	const char *fieldEnd[3];
+	const char *arrival = nextField(&p, lineEnd, &fieldEnd[0]);
+	const char *runTime = arrival ? nextField(&p, lineEnd, &fieldEnd[1]) : NULL;
+	const char *priority = runTime ? nextField(&p, lineEnd, &fieldEnd[2]) : NULL;
+
+	if (priority == NULL) {
+		return 0;
+	}
+
+	job->arrival_time = parseInt(arrival, fieldEnd[0]);
+	job->run_time = parseInt(runTime, fieldEnd[1]);
+	job->priority = parseInt(priority, fieldEnd[2]);
+	return validJob(job);
+}
+
+/*
+ * Little-endian field access for the binary format.
+ */
+static unsigned int getU32(const unsigned char *p)
+{
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void putU32(unsigned char *p, unsigned int value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+}
+
+static unsigned int checksumBytes(unsigned int hash, const unsigned char *p, long length)
+{
+	for (long i = 0; i < length; i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+#define CHECKSUM_SEED 2166136261u
+
+static void decodeRecord(const unsigned char *p, trace_job_t *job)
+{
+	job->arrival_time = (int)getU32(p);
+	job->run_time = (int)getU32(p + 4);
+	job->priority = (int)getU32(p + 8);
+}
+
+/*
+ * Validates a binary header and returns the job count it declares, or -1.
+ */
+static long long decodeHeader(const unsigned char *p, unsigned int *checksum)
+{
+	if (memcmp(p, TRACE_BINARY_MAGIC, 8) != 0 || getU32(p + 8) != TRACE_BINARY_VERSION ||
+			getU32(p + 12) != TRACE_BINARY_RECORD_SIZE || getU32(p + 36) != 0) {
+		return -1;
+	}
+	*checksum = getU32(p + 32);
+	return (long long)getU32(p + 16) | ((long long)getU32(p + 20) << 32);
+}
+
+static int isBinary(const char *data, long length)
+{
+	return length >= 8 && memcmp(data, TRACE_BINARY_MAGIC, 8) == 0;
+}
+
+/*
+ * Reads everything from fd into a malloc'd buffer, for pipes and other
+ * files that cannot be mapped.
+ */
+static char* readAll(int fd, long *length)
+{
+	long capacity = 1 << 16, used = 0;
+	char *buffer = malloc(capacity);
+
+	for (;;) {
+		if (buffer == NULL) {
+			return NULL;
+		}
+		if (used == capacity) {
+			capacity *= 2;
+			char *grown = realloc(buffer, capacity);
+			if (grown == NULL) {
+				free(buffer);
+				return NULL;
+			}
+			buffer = grown;
+		}
+
+		ssize_t got = read(fd, buffer + used, capacity - used);
+		if (got < 0) {
+			free(buffer);
+			return NULL;
+		}
+		if (got == 0) {
+			break;
+		}
+		used += got;
+	}
+
+	*length = used;
+	return buffer;
+}
+
+
+/**
+  Parses a CSV trace held in memory.
+
+  The first line is a header and is skipped. Every other line needs at least
+  three comma-separated fields: arrival time, run time and priority. Extra
+  fields are ignored, and consecutive commas count as one.
+
+  @param trace the trace to fill in; on success the caller must trace_free() it
+  @param text the CSV contents, which need not be NUL-terminated
+  @param length the number of bytes in text
+  @return TRACE_OK, or the reason the text was rejected
+ */
+trace_status_t trace_parse_csv(trace_t *trace, const char *text, long length)
+{
+	const char *p = text, *end = text + length;
+
+	trace->num_jobs = 0;
+	trace->jobs = NULL;
+
+	//Skip the header line
+	const char *newline = memchr(p, '\n', end - p);
+	p = newline ? newline + 1 : end;
+
+	//One pass to size the jobs array, so it is allocated exactly once
+	long lines = 0;
+	for (const char *scan = p; scan < end; lines++) {
+		newline = memchr(scan, '\n', end - scan);
+		scan = newline ? newline + 1 : end;
+	}
+
+	trace->jobs = malloc((lines > 0 ? lines : 1) * sizeof(trace_job_t));
+	if (trace->jobs == NULL) {
+		return TRACE_ERR_MEMORY;
+	}
+
+	while (p < end) {
+		newline = memchr(p, '\n', end - p);
+		//The newline belongs to the line's last field, as it does with fgets()
+		const char *lineEnd = newline ? newline + 1 : end;
+
+		if (!parseLine(p, lineEnd, &trace->jobs[trace->num_jobs])) {
+			trace_free(trace);
+			return TRACE_ERR_FORMAT;
+		}
+
+		trace->num_jobs++;
+		p = lineEnd;
+	}
+
+	return TRACE_OK;
+}
+
+
+/**
+  Parses a binary trace held in memory. See TRACE_BINARY_MAGIC for the layout.
+
+  @param trace the trace to fill in; on success the caller must trace_free() it
+  @param data the file contents
+  @param length the number of bytes in data
+  @return TRACE_OK, or TRACE_ERR_FORMAT if the header, size or checksum is wrong
+ */
+trace_status_t trace_parse_binary(trace_t *trace, const char *data, long length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	unsigned int checksum;
+
+	trace->num_jobs = 0;
+	trace->jobs = NULL;
+
+	if (length < TRACE_BINARY_HEADER_SIZE) {
+		return TRACE_ERR_FORMAT;
+	}
+	long long count = decodeHeader(p, &checksum);
+	if (count < 0 || count > 0x7fffffff ||
+			length != TRACE_BINARY_HEADER_SIZE + count * TRACE_BINARY_RECORD_SIZE) {
+		return TRACE_ERR_FORMAT;
+	}
+
+	p += TRACE_BINARY_HEADER_SIZE;
+	if (checksumBytes(CHECKSUM_SEED, p, count * TRACE_BINARY_RECORD_SIZE) != checksum) {
+		return TRACE_ERR_FORMAT;
+	}
+
+	trace->jobs = malloc((count > 0 ? count : 1) * sizeof(trace_job_t));
+	if (trace->jobs == NULL) {
+		return TRACE_ERR_MEMORY;
+	}
+
+	for (long long i = 0; i < count; i++, p += TRACE_BINARY_RECORD_SIZE) {
+		decodeRecord(p, &trace->jobs[i]);
+		if (!validJob(&trace->jobs[i])) {
+			trace_free(trace);
+			return TRACE_ERR_FORMAT;
+		}
+	}
+	trace->num_jobs = (int)count;
+	return TRACE_OK;
+}
+
+
+/**
+  Writes a trace in the binary format.
+
+  @param trace the trace to write
+  @param file_name the path to write to
+  @return TRACE_OK, or TRACE_ERR_OPEN if the file could not be written
+ */
+trace_status_t trace_save_binary(const trace_t *trace, const char *file_name)
+{
+	FILE *file = fopen(file_name, "wb");
+	if (file == NULL) {
+		return TRACE_ERR_OPEN;
+	}
+
+	unsigned char header[TRACE_BINARY_HEADER_SIZE];
+	unsigned char record[TRACE_BINARY_RECORD_SIZE];
+	unsigned int checksum = CHECKSUM_SEED;
+	int minArrival = 0, maxArrival = 0;
+
+	for (int i = 0; i < trace->num_jobs; i++) {
+		putU32(record, (unsigned int)trace->jobs[i].arrival_time);
+		putU32(record + 4, (unsigned int)trace->jobs[i].run_time);
+		putU32(record + 8, (unsigned int)trace->jobs[i].priority);
+		checksum = checksumBytes(checksum, record, sizeof(record));
+
+		if (i == 0 || trace->jobs[i].arrival_time < minArrival) {
+			minArrival = trace->jobs[i].arrival_time;
+		}
+		if (i == 0 || trace->jobs[i].arrival_time > maxArrival) {
+			maxArrival = trace->jobs[i].arrival_time;
+		}
+	}
+
+	memcpy(header, TRACE_BINARY_MAGIC, 8);
+	putU32(header + 8, TRACE_BINARY_VERSION);
+	putU32(header + 12, TRACE_BINARY_RECORD_SIZE);
+	putU32(header + 16, (unsigned int)trace->num_jobs);
+	putU32(header + 20, 0);
+	putU32(header + 24, (unsigned int)minArrival);
+	putU32(header + 28, (unsigned int)maxArrival);
+	putU32(header + 32, checksum);
+	putU32(header + 36, 0);
+
+	int ok = (fwrite(header, sizeof(header), 1, file) == 1);
+	for (int i = 0; ok && i < trace->num_jobs; i++) {
+		putU32(record, (unsigned int)trace->jobs[i].arrival_time);
+		putU32(record + 4, (unsigned int)trace->jobs[i].run_time);
+		putU32(record + 8, (unsigned int)trace->jobs[i].priority);
+		ok = (fwrite(record, sizeof(record), 1, file) == 1);
+	}
+
+	if (fclose(file) != 0) {
+		ok = 0;
+	}
+	return ok ? TRACE_OK : TRACE_ERR_OPEN;
+}
+
+
+/**
+  Loads a trace file, in either the CSV or the binary format.
+
+  Regular files are memory-mapped. Anything that cannot be mapped (stdin,
+  pipes, FIFOs) is read into memory first. A file name of "-" reads stdin.
+  Files starting with TRACE_BINARY_MAGIC are read as binary traces.
+
+  @param trace the trace to fill in; on success the caller must trace_free() it
+  @param file_name the path of the trace, or "-" for stdin
+  @return TRACE_OK, or the reason the trace could not be loaded
+ */
+trace_status_t trace_load(trace_t *trace, const char *file_name)
+{
+	int fd = (strcmp(file_name, "-") == 0) ? STDIN_FILENO : open(file_name, O_RDONLY);
+	if (fd < 0) {
+		return TRACE_ERR_OPEN;
+	}
+
+	struct stat info;
+	char *text = NULL;
+	long length = 0;
+	int mapped = 0;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+		text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text != MAP_FAILED) {
+			length = info.st_size;
+			mapped = 1;
+			madvise(text, length, MADV_SEQUENTIAL);
+		} else {
+			text = NULL;
+		}
+	}
+
+	trace_status_t status = TRACE_OK;
+	if (!mapped) {
+		text = readAll(fd, &length);
+		if (text == NULL) {
+			status = TRACE_ERR_OPEN;
+		}
+	}
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+
+	if (status == TRACE_OK) {
+		if (isBinary(text, length)) {
+			status = trace_parse_binary(trace, text, length);
+		} else {
+			status = trace_parse_csv(trace, text, length);
+		}
+	}
+
+	if (mapped) {
+		munmap(text, length);
+	} else {
+		free(text);
+	}
+	return status;
+}
+
+
+/**
+  Frees the jobs of a trace loaded by trace_load() or trace_parse_csv().
+
+  @param trace the trace to free
+ */
+void trace_free(trace_t *trace)
+{
+	free(trace->jobs);
+	trace->jobs = NULL;
+	trace->num_jobs = 0;
+}
+
+
+/*
+ * Streaming reader
+ */
+
+//Makes at least want bytes available at reader->buffer + reader->start, unless the file ends first
+static long readerFill(trace_reader_t *reader, long want)
+{
+	while (reader->end - reader->start < want && !reader->eof) {
+		if (reader->start > 0) {
+			memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+			reader->end -= reader->start;
+			reader->start = 0;
+		}
+		if (reader->end == reader->capacity) {
+			char *grown = realloc(reader->buffer, reader->capacity * 2);
+			if (grown == NULL) {
+				reader->status = TRACE_ERR_MEMORY;
+				return 0;
+			}
+			reader->buffer = grown;
+			reader->capacity *= 2;
+		}
+
+		ssize_t got = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end);
+		if (got < 0) {
+			reader->status = TRACE_ERR_OPEN;
+			return 0;
+		}
+		if (got == 0) {
+			reader->eof = 1;
+		}
+		reader->end += got;
+	}
+	return reader->end - reader->start;
+}
+
+//Finds the end of the next CSV line, newline included, or returns NULL at end of file
+static const char* readerLine(trace_reader_t *reader)
+{
+	long scanned = 0;
+	for (;;) {
+		const char *start = reader->buffer + reader->start;
+		long available = reader->end - reader->start;
+		const char *newline = memchr(start + scanned, '\n', available - scanned);
+		if (newline != NULL) {
+			return newline + 1;
+		}
+		if (reader->eof) {
+			return available > 0 ? start + available : NULL;
+		}
+		scanned = available;
+		if (readerFill(reader, available + 1) <= available && reader->status != TRACE_OK) {
+			return NULL;
+		}
+	}
+}
+
+
+/**
+  Opens a trace for streaming. The format is detected from the first bytes.
+
+  @param reader the reader to set up; call trace_reader_close() when done
+  @param file_name the path of the trace, or "-" for stdin
+  @return TRACE_OK, or the reason the trace could not be opened
+ */
+trace_status_t trace_reader_open(trace_reader_t *reader, const char *file_name)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->declared_jobs = -1;
+	reader->fd = (strcmp(file_name, "-") == 0) ? STDIN_FILENO : open(file_name, O_RDONLY);
+	if (reader->fd < 0) {
+		return reader->status = TRACE_ERR_OPEN;
+	}
+
+	reader->capacity = 1 << 16;
+	reader->buffer = malloc(reader->capacity);
+	if (reader->buffer == NULL) {
+		return reader->status = TRACE_ERR_MEMORY;
+	}
+	reader->checksum = CHECKSUM_SEED;
+
+	long available = readerFill(reader, TRACE_BINARY_HEADER_SIZE);
+	if (reader->status != TRACE_OK) {
+		return reader->status;
+	}
+
+	if (isBinary(reader->buffer, available)) {
+		reader->binary = 1;
+		if (available < TRACE_BINARY_HEADER_SIZE) {
+			return reader->status = TRACE_ERR_FORMAT;
+		}
+		reader->declared_jobs = decodeHeader((const unsigned char *)reader->buffer, &reader->declared_checksum);
+		if (reader->declared_jobs < 0) {
+			return reader->status = TRACE_ERR_FORMAT;
+		}
+		reader->start = TRACE_BINARY_HEADER_SIZE;
+	} else {
+		//Skip the CSV header line
+		const char *lineEnd = readerLine(reader);
+		if (lineEnd != NULL) {
+			reader->start = lineEnd - reader->buffer;
+		}
+	}
+	return reader->status;
+}
+
+
+/**
+  Reads the next batch of jobs, in file order.
+
+  Binary traces are checked against the job count and checksum in their
+  header once the last record has been read.
+
+  @param reader a reader set up by trace_reader_open()
+  @param jobs where to store the jobs
+  @param max_jobs the most jobs to return at once
+  @return the number of jobs stored, 0 at the end of the trace, or -1 on an
+    error (see reader->status)
+ */
+int trace_reader_next(trace_reader_t *reader, trace_job_t *jobs, int max_jobs)
+{
+	int count = 0;
+	if (reader->status != TRACE_OK) {
+		return -1;
+	}
+
+	if (reader->binary) {
+		while (count < max_jobs && reader->jobs_read < reader->declared_jobs) {
+			if (readerFill(reader, TRACE_BINARY_RECORD_SIZE) < TRACE_BINARY_RECORD_SIZE) {
+				if (reader->status == TRACE_OK) {
+					reader->status = TRACE_ERR_FORMAT;
+				}
+				return -1;
+			}
+
+			const unsigned char *p = (const unsigned char *)reader->buffer + reader->start;
+			reader->checksum = checksumBytes(reader->checksum, p, TRACE_BINARY_RECORD_SIZE);
+			decodeRecord(p, &jobs[count]);
+			reader->start += TRACE_BINARY_RECORD_SIZE;
+			reader->jobs_read++;
+
+			if (!validJob(&jobs[count++])) {
+				reader->status = TRACE_ERR_FORMAT;
+				return -1;
+			}
+		}
+
+		if (reader->jobs_read == reader->declared_jobs &&
+				(reader->checksum != reader->declared_checksum || readerFill(reader, 1) != 0)) {
+			reader->status = TRACE_ERR_FORMAT;
+			return -1;
+		}
+		return count;
+	}
+
+	while (count < max_jobs) {
+		const char *lineEnd = readerLine(reader);
+		if (lineEnd == NULL) {
+			break;
+		}
+
+		if (!parseLine(reader->buffer + reader->start, lineEnd, &jobs[count])) {
+			reader->status = TRACE_ERR_FORMAT;
+			return -1;
+		}
+		reader->start = lineEnd - reader->buffer;
+		reader->jobs_read++;
+		count++;
+	}
+	return reader->status == TRACE_OK ? count : -1;
+}
+
+
+/**
+  Closes a reader opened by trace_reader_open().
+
+  @param reader the reader to close
+ */
+void trace_reader_close(trace_reader_t *reader)
+{
+	if (reader->fd > STDIN_FILENO) {
+		close(reader->fd);
+	}
+	free(reader->buffer);
+	reader->buffer = NULL;
+}
@@ -0,0 +1,80 @@
+/** @file libtrace.h
+ */
+
+#ifndef LIBTRACE_H_
+#define LIBTRACE_H_
+
+/**
+  One job as read from a trace file
+*/
+typedef struct _trace_job_t {
+  int arrival_time;
+  int run_time;
+  int priority;
+} trace_job_t;
+
+/**
+  A fully loaded trace, in file order. Job i of the trace is job_id i.
+*/
+typedef struct _trace_t {
+  int num_jobs;
+  trace_job_t* jobs;
+} trace_t;
+
+/**
+  Results of loading a trace
+*/
+typedef enum {
+  TRACE_OK = 0,
+  TRACE_ERR_OPEN,   ///< the file could not be opened or read
+  TRACE_ERR_FORMAT, ///< a line is not "arrival,run time,priority" with an arrival of 0 or later and a positive run time
+  TRACE_ERR_MEMORY  ///< out of memory
+} trace_status_t;
+
+/**
+  Binary trace layout. All fields are little-endian.
+
+    offset  size  field
+         0     8  magic, TRACE_BINARY_MAGIC
+         8     4  version, TRACE_BINARY_VERSION
+        12     4  record size in bytes, TRACE_BINARY_RECORD_SIZE
+        16     8  job count
+        24     4  earliest arrival time
+        28     4  latest arrival time
+        32     4  FNV-1a checksum of all the record bytes
+        36     4  reserved, 0
+        40        job count records of int32 arrival time, run time, priority
+*/
+#define TRACE_BINARY_MAGIC        "SCHTRACE"
+#define TRACE_BINARY_VERSION      1
+#define TRACE_BINARY_HEADER_SIZE  40
+#define TRACE_BINARY_RECORD_SIZE  12
+
+/**
+  Incremental reader that hands out a trace's jobs a batch at a time, for
+  traces too large to hold in memory. Works on either format.
+*/
+typedef struct _trace_reader_t {
+  int fd;
+  int binary;               ///< 1 for the binary format, 0 for CSV
+  long long declared_jobs;  ///< job count from the binary header, -1 for CSV
+  long long jobs_read;
+  unsigned int checksum;
+  unsigned int declared_checksum;
+  trace_status_t status;    ///< first error seen, TRACE_OK otherwise
+  char* buffer;
+  long capacity, start, end;
+  int eof;
+} trace_reader_t;
+
+trace_status_t trace_load        (trace_t *trace, const char *file_name);
+trace_status_t trace_parse_csv   (trace_t *trace, const char *text, long length);
+trace_status_t trace_parse_binary(trace_t *trace, const char *data, long length);
+trace_status_t trace_save_binary (const trace_t *trace, const char *file_name);
+void           trace_free        (trace_t *trace);
+
+trace_status_t trace_reader_open (trace_reader_t *reader, const char *file_name);
+int            trace_reader_next (trace_reader_t *reader, trace_job_t *jobs, int max_jobs);
+void           trace_reader_close(trace_reader_t *reader);
+
+#endif /* LIBTRACE_H_ */
@@ -0,0 +1,396 @@
+/** @file pqbench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "libpriqueue/libpriqueue.h"
+#include "libpriqueue/libpriqueue_typed.h"
+
+
+/*
+ * Microbenchmarks for the queue backends the scheduler can sit on: the
+ * priqueue_t list, heap, FIFO and tree backends and the typed bucket queue.
+ * Every (backend, workload, size) row runs in its own forked child, so the
+ * peak RSS it reports belongs to that row alone, and prints one CSV line.
+ *
+ * Each operation is timed on its own; ns/op is the mean of those timings,
+ * so it includes one clock read per operation (around 20ns on Linux).
+ */
+
+#define KEY_RANGE (1 << 20)
+#define BUCKET_LEVELS 256
+
+typedef enum { BENCH_LIST = 0, BENCH_HEAP, BENCH_FIFO, BENCH_TREE, BENCH_BUCKET, BENCH_BACKENDS } bench_backend_t;
+typedef enum { BENCH_RANDOM = 0, BENCH_REQUEUE, BENCH_ASCENDING, BENCH_DESCENDING, BENCH_REMOVE, BENCH_WORKLOADS } bench_workload_t;
+
+static const char *backend_names[] = { "list", "heap", "fifo", "tree", "bucket" };
+static const char *workload_names[] = { "random", "requeue", "ascending", "descending", "remove" };
+
+static inline int key_level(const unsigned int *a, void *user)
+{
+	return *a / (KEY_RANGE / BUCKET_LEVELS);
+}
+
+static inline int compare_keys(const unsigned int *a, const unsigned int *b, void *user)
+{
+	return (*a > *b) - (*a < *b);
+}
+
+PRIQUEUE_DEFINE_BUCKET(bench_buckets, unsigned int, key_level, compare_keys, BUCKET_LEVELS)
+
+//priqueue_t elements are the keys themselves, offset by one so that key 0 is not NULL
+#define KEY_TO_PTR(key) ((void*)(uintptr_t)((key) + 1))
+#define PTR_TO_KEY(ptr) ((unsigned int)((uintptr_t)(ptr) - 1))
+
+int compare_ptrs(const void *a, const void *b)
+{
+	return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+/*
+ * One queue under test, whichever backend it is built on.
+ */
+typedef struct _bench_queue_t
+{
+	bench_backend_t backend;
+	priqueue_t pq;
+	bench_buckets_t *buckets;
+} bench_queue_t;
+
+void queue_init(bench_queue_t *q, bench_backend_t backend)
+{
+	q->backend = backend;
+	if (backend == BENCH_BUCKET)
+	{
+		q->buckets = malloc(sizeof(bench_buckets_t));
+		bench_buckets_init(q->buckets, NULL);
+	}
+	else
+	{
+		priqueue_attr_t attr = { .backend = backend == BENCH_HEAP ? PRIQUEUE_HEAP : backend == BENCH_FIFO ? PRIQUEUE_FIFO :
+			backend == BENCH_TREE ? PRIQUEUE_TREE : PRIQUEUE_LIST };
+		priqueue_init_attr(&q->pq, compare_ptrs, &attr);
+	}
+}
+
+static inline void queue_offer(bench_queue_t *q, unsigned int key)
+{
+	if (q->backend == BENCH_BUCKET)
+		bench_buckets_offer(q->buckets, key);
+	else
+		priqueue_offer(&q->pq, KEY_TO_PTR(key));
+}
+
+static inline int queue_poll(bench_queue_t *q, unsigned int *key)
+{
+	if (q->backend == BENCH_BUCKET)
+		return bench_buckets_poll(q->buckets, key);
+
+	void *ptr = priqueue_poll(&q->pq);
+	if (ptr == NULL)
+		return 0;
+	*key = PTR_TO_KEY(ptr);
+	return 1;
+}
+
+static inline void queue_remove(bench_queue_t *q, unsigned int key)
+{
+	priqueue_remove(&q->pq, KEY_TO_PTR(key));
+}
+
+void queue_destroy(bench_queue_t *q)
+{
+	if (q->backend == BENCH_BUCKET)
+	{
+		bench_buckets_destroy(q->buckets);
+		free(q->buckets);
+	}
+	else
+		priqueue_destroy(&q->pq);
+}
+
+/*
+ * Log-linear latency histogram: exact below 16ns, then 16 slots for every
+ * power of two, so a percentile is never off by more than 1/16th.
+ */
+#define HIST_SUB 16
+#define HIST_SLOTS (64 * HIST_SUB)
+
+typedef struct _bench_hist_t
+{
+	unsigned long long counts[HIST_SLOTS];
+	unsigned long long samples;
+	unsigned long long total_ns;
+} bench_hist_t;
+
+static inline void hist_add(bench_hist_t *h, unsigned long long ns)
+{
+	int slot;
+	if (ns < HIST_SUB)
+		slot = (int)ns;
+	else
+	{
+		int shift = 63 - __builtin_clzll(ns) - 4;
+		slot = shift * HIST_SUB + (int)(ns >> shift);
+	}
+	h->counts[slot]++;
+	h->samples++;
+	h->total_ns += ns;
+}
+
+//Upper bound of the slot holding the p-th fraction of the samples
+unsigned long long hist_percentile(const bench_hist_t *h, double p)
+{
+	unsigned long long rank = (unsigned long long)(p * h->samples), seen = 0;
+	for (int slot = 0; slot < HIST_SLOTS; slot++)
+	{
+		seen += h->counts[slot];
+		if (seen > rank)
+		{
+			if (slot < HIST_SUB)
+				return slot;
+			int shift = slot / HIST_SUB - 1;
+			return (unsigned long long)(slot % HIST_SUB + HIST_SUB + 1) << shift;
+		}
+	}
+	return 0;
+}
+
+static inline unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (unsigned int)(*state >> 32);
+}
+
+#define TIMED(h, op) do { unsigned long long t0 = now_ns(); op; hist_add(h, now_ns() - t0); } while (0)
+
+/*
+ * Runs one workload on a fresh queue of the given backend.
+ *   random      n offers, then n operations that poll or offer a random key at even odds
+ *   requeue     n equal keys, then n polls each followed by offering the job back (RR)
+ *   ascending   n offers in increasing key order, then n polls
+ *   descending  n offers in decreasing key order, then n polls
+ *   remove      n distinct keys in random order, then priqueue_remove of each in another
+ * Only the operations after the "then" are timed for random, requeue and remove.
+ */
+void run_workload(bench_queue_t *q, bench_workload_t workload, int n, bench_hist_t *h)
+{
+	uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)n;
+	unsigned int key = 0;
+	int i;
+
+	switch (workload)
+	{
+		case BENCH_RANDOM:
+			for (i = 0; i < n; i++)
+				queue_offer(q, next_random(&rng) % KEY_RANGE);
+			for (i = 0; i < n; i++)
+			{
+				unsigned int r = next_random(&rng);
+				if (r & 1)
+					TIMED(h, queue_offer(q, (r >> 1) % KEY_RANGE));
+				else
+					TIMED(h, queue_poll(q, &key));
+			}
+			break;
+
+		case BENCH_REQUEUE:
+			for (i = 0; i < n; i++)
+				queue_offer(q, 0);
+			for (i = 0; i < n; i++)
+			{
+				TIMED(h, queue_poll(q, &key));
+				TIMED(h, queue_offer(q, key));
+			}
+			break;
+
+		case BENCH_ASCENDING:
+		case BENCH_DESCENDING:
+			for (i = 0; i < n; i++)
+			{
+				unsigned int k = (unsigned int)((uint64_t)(workload == BENCH_ASCENDING ? i : n - 1 - i) * KEY_RANGE / n);
+				TIMED(h, queue_offer(q, k));
+			}
+			for (i = 0; i < n; i++)
+				TIMED(h, queue_poll(q, &key));
+			break;
+
+		case BENCH_REMOVE:
+		{
+			unsigned int *order = malloc(sizeof(unsigned int) * n);
+			for (i = 0; i < n; i++)
+				order[i] = i;
+			for (int pass = 0; pass < 2; pass++)
+			{
+				for (i = n - 1; i > 0; i--)
+				{
+					int j = next_random(&rng) % (i + 1);
+					unsigned int t = order[i];
+					order[i] = order[j];
+					order[j] = t;
+				}
+				for (i = 0; i < n; i++)
+				{
+					if (pass == 0)
+						queue_offer(q, order[i]);
+					else
+						TIMED(h, queue_remove(q, order[i]));
+				}
+			}
+			free(order);
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+/*
+ * True when the row is O(n^2) in n: anything that walks the list, removal
+ * by value, and bucket levels that get filled in random order (each level
+ * only takes a new head or tail in O(1)).
+ */
+int quadratic(bench_backend_t backend, bench_workload_t workload)
+{
+	if (workload == BENCH_REMOVE)
+		return 1;
+	if (backend == BENCH_LIST)
+		return workload != BENCH_DESCENDING;
+	if (backend == BENCH_BUCKET)
+		return workload == BENCH_RANDOM;
+	return 0;
+}
+
+/*
+ * Returns whether name appears in the comma separated list.
+ */
+int in_list(const char *list, const char *name)
+{
+	size_t length = strlen(name);
+	while (*list)
+	{
+		size_t item = strcspn(list, ",");
+		if (item == length && strncasecmp(list, name, length) == 0)
+			return 1;
+		list += item;
+		if (*list == ',')
+			list++;
+	}
+	return 0;
+}
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-n <sizes>] [-b <backends>] [-w <workloads>] [-q <size>]\n", program_name);
+	fprintf(stderr, "       %s -n 10,1000,100000,10000000 -b heap,bucket\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -n  comma separated queue sizes (default 10,1000,100000,1000000)\n");
+	fprintf(stderr, "  -b  comma separated backends: list, heap, fifo, tree, bucket (default all)\n");
+	fprintf(stderr, "  -w  comma separated workloads: random, requeue, ascending, descending, remove (default all)\n");
+	fprintf(stderr, "  -q  largest size to run O(n^2) rows at: list walks, unordered bucket fills and remove (default 20000)\n");
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	char *sizes = "10,1000,100000,1000000";
+	char *backends = "list,heap,fifo,tree,bucket";
+	char *workloads = "random,requeue,ascending,descending,remove";
+	long quadratic_cap = 20000;
+
+	while ((c = getopt(argc, argv, "n:b:w:q:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				sizes = optarg;
+				break;
+
+			case 'b':
+				backends = optarg;
+				break;
+
+			case 'w':
+				workloads = optarg;
+				break;
+
+			case 'q':
+				quadratic_cap = atol(optarg);
+				break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	printf("\"Backend\",\"Workload\",\"Size\",\"Ops\",\"ns/op\",\"p50 ns\",\"p99 ns\",\"Peak RSS KB\"\n");
+	fflush(stdout);
+
+	int failed = 0;
+	for (const char *s = sizes; *s; s += strcspn(s, ","), s += (*s == ','))
+	{
+		long n = atol(s);
+		if (n <= 0)
+		{
+			fprintf(stderr, "Option -n <sizes> requires positive numbers.\n");
+			return 1;
+		}
+
+		for (int w = 0; w < BENCH_WORKLOADS; w++)
+		{
+			for (int b = 0; b < BENCH_BACKENDS; b++)
+			{
+				if (!in_list(workloads, workload_names[w]) || !in_list(backends, backend_names[b]))
+					continue;
+				//The bucket queue has no removal by value, and n^2 rows get too slow to wait for
+				if ((b == BENCH_BUCKET && w == BENCH_REMOVE) || (quadratic(b, w) && n > quadratic_cap))
+					continue;
+
+				pid_t pid = fork();
+				if (pid == 0)
+				{
+					bench_queue_t q;
+					bench_hist_t *h = calloc(1, sizeof(bench_hist_t));
+					queue_init(&q, b);
+					run_workload(&q, w, (int)n, h);
+					queue_destroy(&q);
+
+					struct rusage usage;
+					getrusage(RUSAGE_SELF, &usage);
+					printf("%s,%s,%ld,%llu,%.1f,%llu,%llu,%ld\n", backend_names[b], workload_names[w], n, h->samples,
+						h->samples ? (double)h->total_ns / h->samples : 0.0,
+						hist_percentile(h, 0.50), hist_percentile(h, 0.99), usage.ru_maxrss);
+					free(h);
+					exit(0);
+				}
+
+				int status;
+				if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				{
+					fprintf(stderr, "Benchmark %s/%s at %ld did not complete.\n", backend_names[b], workload_names[w], n);
+					failed++;
+				}
+			}
+		}
+	}
+
+	return failed ? 3 : 0;
+}
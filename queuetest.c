@@ -5,6 +5,7 @@
 #include <stdlib.h>
 
 #include "libpriqueue/libpriqueue.h"
+#include "libpriqueue/libpriqueue_typed.h"
 
 int compare1(const void * a, const void * b)
 {
@@ -16,6 +17,32 @@ int compare2(const void * a, const void * b)
 	return ( *(int*)b - *(int*)a );
 }
 
+int compare_mod(const void * a, const void * b, void * user)
+{
+	int mod = *(int*)user;
+	return ( *(int*)a % mod - *(int*)b % mod );
+}
+
+static inline int compare_tens(const int * a, const int * b, void * user)
+{
+	int unit = *(int*)user;
+	return ( *a / unit - *b / unit );
+}
+
+PRIQUEUE_DEFINE(tens, int, compare_tens)
+
+static inline int level_of(const int * a, void * user)
+{
+	return *a / *(int*)user;
+}
+
+static inline int compare_values(const int * a, const int * b, void * user)
+{
+	return ( *a - *b );
+}
+
+PRIQUEUE_DEFINE_BUCKET(buckets, int, level_of, compare_values, 8)
+
 int main()
 {
 	priqueue_t q, q2;
@@ -26,7 +53,7 @@ int main()
 	/* Pupulate some data... */
 	int *values = malloc(100 * sizeof(int));
 
-	int i;
+	int i, j;
 	for (i = 0; i < 100; i++)
 		values[i] = i;
 
@@ -68,6 +95,301 @@ int main()
 	priqueue_destroy(&q2);
 	priqueue_destroy(&q);
 
+	/* Same checks against the heap backend. */
+	priqueue_attr_t heap_attr = { .backend = PRIQUEUE_HEAP };
+	priqueue_init_attr(&q, compare1, &heap_attr);
+
+	priqueue_offer(&q, &values[12]);
+	priqueue_offer(&q, &values[13]);
+	priqueue_offer(&q, &values[14]);
+	priqueue_offer(&q, &values[12]);
+	priqueue_offer(&q, &values[12]);
+	printf("Heap total elements: %d (expected 5).\n", priqueue_size(&q));
+
+	val = *((int *)priqueue_poll(&q));
+	printf("Heap top element: %d (expected 12).\n", val);
+
+	vals_removed = priqueue_remove(&q, &values[12]);
+	printf("Heap elements removed: %d (expected 2).\n", vals_removed);
+
+	priqueue_offer(&q, &values[10]);
+	priqueue_offer(&q, &values[30]);
+	priqueue_offer(&q, &values[20]);
+
+	printf("Heap elements in order queue (expected 10 13 14 20 30): ");
+	for (i = 0; i < priqueue_size(&q); i++)
+		printf("%d ", *((int *)priqueue_at(&q, i)) );
+	printf("\n");
+
+	priqueue_destroy(&q);
+
+	/* Ties must come back out in the order they went in. */
+	int ties[4] = { 7, 7, 3, 7 };
+	priqueue_init_attr(&q, compare1, &heap_attr);
+	for (i = 0; i < 4; i++)
+		priqueue_offer(&q, &ties[i]);
+
+	printf("Heap tie order (expected 2 0 1 3): ");
+	while (priqueue_size(&q) > 0)
+		printf("%d ", (int)((int *)priqueue_poll(&q) - ties));
+	printf("\n");
+
+	priqueue_destroy(&q);
+
+	/* The FIFO backend ignores the comparer and keeps insertion order, including across wrap-around. */
+	priqueue_attr_t fifo_attr = { .backend = PRIQUEUE_FIFO };
+	priqueue_init_attr(&q, compare1, &fifo_attr);
+	for (i = 0; i < 16; i++)
+		priqueue_offer(&q, &values[i]);
+	for (i = 0; i < 12; i++)
+		priqueue_poll(&q);
+	priqueue_offer(&q, &values[40]);
+	priqueue_offer(&q, &values[13]);
+	priqueue_offer(&q, &values[30]);
+	vals_removed = priqueue_remove(&q, &values[13]);
+	printf("FIFO elements removed: %d (expected 2).\n", vals_removed);
+	for (i = 50; i < 65; i++)
+		priqueue_offer(&q, &values[i]);
+
+	printf("FIFO elements in order queue (expected 12 14 15 40 30 50 51): ");
+	for (i = 0; i < 7; i++)
+		printf("%d ", *((int *)priqueue_at(&q, i)) );
+	printf("\n");
+	printf("FIFO total elements: %d (expected 20).\n", priqueue_size(&q));
+
+	priqueue_destroy(&q);
+
+	/* Handles let elements be removed or re-keyed in place, whatever the backend. */
+	priqueue_backend_t backends[4] = { PRIQUEUE_LIST, PRIQUEUE_HEAP, PRIQUEUE_FIFO, PRIQUEUE_TREE };
+	const char *backend_names[4] = { "List", "Heap", "FIFO", "Tree" };
+	int keys[6];
+	for (int b = 0; b < 4; b++)
+	{
+		priqueue_attr_t handle_attr = { .backend = backends[b] };
+		priqueue_handle_t handles[6];
+		priqueue_init_attr(&q, compare1, &handle_attr);
+
+		for (i = 0; i < 6; i++)
+		{
+			keys[i] = 10 * (i + 1);
+			handles[i] = priqueue_offer_handle(&q, &keys[i]);
+		}
+
+		priqueue_remove_handle(&q, handles[4]);
+		priqueue_remove_handle(&q, handles[1]);
+		keys[5] = 5;
+		priqueue_update_handle(&q, handles[5]);
+
+		printf("%s handle removal and update (expected %s): ", backend_names[b],
+				backends[b] == PRIQUEUE_FIFO ? "10 30 40 5" : "5 10 30 40");
+		while (priqueue_size(&q) > 0)
+			printf("%d ", *((int *)priqueue_poll(&q)) );
+		printf("\n");
+
+		priqueue_destroy(&q);
+
+		/* Re-keying to an equal key must not move the element behind its ties. */
+		priqueue_init_attr(&q, compare1, &handle_attr);
+		for (i = 0; i < 4; i++)
+			handles[i] = priqueue_offer_handle(&q, &ties[i]);
+		priqueue_update_handle(&q, handles[0]);
+
+		printf("%s tie order after update (expected %s): ", backend_names[b],
+				backends[b] == PRIQUEUE_FIFO ? "0 1 2 3" : "2 0 1 3");
+		while (priqueue_size(&q) > 0)
+			printf("%d ", (int)((int *)priqueue_poll(&q) - ties));
+		printf("\n");
+
+		priqueue_destroy(&q);
+	}
+
+	/* The tree keeps ties in insertion order and agrees with the heap through a long mix of offers, polls and handle removals. */
+	priqueue_attr_t tree_attr = { .backend = PRIQUEUE_TREE };
+	priqueue_init_attr(&q, compare1, &tree_attr);
+	for (i = 0; i < 4; i++)
+		priqueue_offer(&q, &ties[i]);
+
+	printf("Tree tie order (expected 2 0 1 3): ");
+	while (priqueue_size(&q) > 0)
+		printf("%d ", (int)((int *)priqueue_poll(&q) - ties));
+	printf("\n");
+
+	priqueue_init_attr(&q2, compare1, &heap_attr);
+	priqueue_handle_t tree_handles[100], heap_handles[100];
+	int queued[100] = { 0 };
+	unsigned int seed = 1;
+	int mismatches = 0;
+	for (i = 0; i < 20000; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		int v = (seed >> 16) % 100;
+		if (!queued[v])
+		{
+			tree_handles[v] = priqueue_offer_handle(&q, &values[v]);
+			heap_handles[v] = priqueue_offer_handle(&q2, &values[v]);
+			queued[v] = 1;
+		}
+		else if (v % 2)
+		{
+			priqueue_remove_handle(&q, tree_handles[v]);
+			priqueue_remove_handle(&q2, heap_handles[v]);
+			queued[v] = 0;
+		}
+		else
+		{
+			int *head = priqueue_poll(&q);
+			mismatches += (head != priqueue_poll(&q2));
+			queued[*head] = 0;
+		}
+		mismatches += (priqueue_size(&q) != priqueue_size(&q2) || priqueue_peek(&q) != priqueue_peek(&q2));
+
+		// Lookups by position, which the heap answers from a sorted view it must rebuild after every change
+		if (priqueue_size(&q) > 0)
+		{
+			int k = (seed >> 4) % priqueue_size(&q);
+			mismatches += (priqueue_at(&q, k) != priqueue_at(&q2, k));
+		}
+		for (j = 0; i % 1000 == 0 && j < priqueue_size(&q); j++)
+			mismatches += (priqueue_at(&q, j) != priqueue_at(&q2, j));
+	}
+	while (priqueue_size(&q) > 0)
+		mismatches += (priqueue_poll(&q) != priqueue_poll(&q2));
+	printf("Tree and heap disagreed %d time(s) (expected 0).\n", mismatches);
+
+	priqueue_destroy(&q2);
+	priqueue_destroy(&q);
+
+	/* Two queues drawing nodes from one preallocated pool. */
+	priqueue_pool_t pool;
+	priqueue_pool_init(&pool, 8);
+	priqueue_attr_t pool_attr = { .backend = PRIQUEUE_LIST, .pool = &pool };
+	priqueue_init_attr(&q, compare1, &pool_attr);
+	pool_attr.backend = PRIQUEUE_HEAP;
+	priqueue_init_attr(&q2, compare2, &pool_attr);
+
+	for (i = 0; i < 1000; i++)
+	{
+		priqueue_offer(&q, &values[i % 100]);
+		priqueue_offer(&q2, &values[i % 100]);
+		priqueue_poll(&q);
+		priqueue_poll(&q2);
+	}
+	priqueue_offer(&q, &values[5]);
+	priqueue_offer(&q2, &values[6]);
+	printf("Pooled queue heads: %d %d (expected 5 6).\n",
+			*((int *)priqueue_peek(&q)), *((int *)priqueue_peek(&q2)));
+
+	priqueue_destroy(&q2);
+	priqueue_destroy(&q);
+	priqueue_pool_destroy(&pool);
+
+	/* A comparer that reads its modulus through the user pointer, on both ordered backends. */
+	int mod = 7;
+	priqueue_attr_t user_attr = { .backend = PRIQUEUE_LIST };
+	priqueue_init_user(&q, compare_mod, &mod, &user_attr);
+	user_attr.backend = PRIQUEUE_HEAP;
+	priqueue_init_user(&q2, compare_mod, &mod, &user_attr);
+
+	for (i = 10; i < 20; i++)
+	{
+		priqueue_offer(&q, &values[i]);
+		priqueue_offer(&q2, &values[i]);
+	}
+
+	mismatches = 0;
+	printf("Mod %d order (expected 14 15 16 10 17 11 18 12 19 13): ", mod);
+	while (priqueue_size(&q) > 0)
+	{
+		int *value = priqueue_poll(&q);
+		mismatches += (value != priqueue_poll(&q2));
+		printf("%d ", *value);
+	}
+	printf("\nList and heap disagreed %d time(s) (expected 0).\n", mismatches);
+
+	priqueue_destroy(&q2);
+	priqueue_destroy(&q);
+
+	/* The macro-generated heap orders by tens and keeps insertion order within each ten. */
+	tens_t t;
+	int unit = 10, value;
+	tens_init(&t, 0, &unit);
+	int order[] = { 35, 12, 31, 18, 3, 37, 15, 0 };
+	for (i = 0; i < 8; i++)
+		tens_offer(&t, order[i]);
+
+	printf("Typed heap order (expected 3 0 12 18 15 35 31 37): ");
+	while (tens_poll(&t, &value))
+		printf("%d ", value);
+	printf("\n");
+	tens_destroy(&t);
+
+	/* Offering a batch at once, big enough to rebuild the heap, keeps the same order. */
+	tens_init(&t, 0, &unit);
+	tens_offer(&t, 35);
+	tens_offer(&t, 12);
+	tens_offer_all(&t, order + 2, 6);
+
+	printf("Typed heap batch order (expected 3 0 12 18 15 35 31 37): ");
+	while (tens_poll(&t, &value))
+		printf("%d ", value);
+	printf("\n");
+	tens_destroy(&t);
+
+	/* The bucket queue empties the lowest level first, keeping each level sorted even when offered out of order. */
+	buckets_t b;
+	buckets_init(&b, &unit);
+	int levels[] = { 35, 12, 31, 18, 3, 37, 15, 0, 79, 34 };
+	for (i = 0; i < 10; i++)
+		buckets_offer(&b, levels[i]);
+
+	printf("Bucket queue order (expected 0 3 12 15 18 31 34 35 37 79): ");
+	while (buckets_poll(&b, &value))
+		printf("%d ", value);
+	printf("\n");
+	buckets_destroy(&b);
+
+	/* A level filled in descending order grows its ring from the head, across reallocations, without shifting. */
+	int wide = 100, sorted = 1, previous = -1;
+	buckets_init(&b, &wide);
+	for (i = 39; i >= 0; i--)
+		buckets_offer(&b, i);
+	for (i = 0; buckets_poll(&b, &value); i++)
+	{
+		sorted = sorted && value == previous + 1;
+		previous = value;
+	}
+	printf("Bucket queue descending fill: %d polled, %s (expected 40 polled, in order)\n", i, sorted ? "in order" : "out of order");
+#ifdef SCHED_STATS
+	printf("Bucket queue descending fill shifted: %llu (expected 0)\n", b.stats.traversed);
+#endif
+	buckets_destroy(&b);
+
+#ifdef SCHED_STATS
+	/* Re-keying a handle re-links its node, so only an offer that has to malloc counts as an allocation. */
+	priqueue_attr_t list_attr = { .backend = PRIQUEUE_LIST };
+	priqueue_handle_t handles[6];
+	priqueue_init_attr(&q, compare1, &list_attr);
+	for (i = 0; i < 6; i++)
+	{
+		keys[i] = 10 * (i + 1);
+		handles[i] = priqueue_offer_handle(&q, &keys[i]);
+	}
+	for (i = 0; i < 100; i++)
+	{
+		keys[i % 6] = (i * 7) % 61;
+		priqueue_update_handle(&q, handles[i % 6]);
+	}
+	printf("List allocations: %llu (expected 1).\n", q.stats.allocations);
+	priqueue_destroy(&q);
+
+	tens_init(&t, 0, &unit);
+	for (i = 0; i < 8; i++)
+		tens_offer(&t, order[i]);
+	printf("Typed heap allocations: %llu (expected 1), comparisons counted: %d (expected 1).\n",
+			t.stats.allocations, t.stats.comparisons > 0);
+	tens_destroy(&t);
+#endif
+
 	free(values);
 
 	return 0;
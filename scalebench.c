@@ -0,0 +1,167 @@
+/** @file scalebench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+
+/*
+ * End-to-end scaling benchmark: generates a trace of every requested size
+ * with ./tracegen, then times "./simulator -e -q" over every scheme and
+ * core count on it and prints one CSV row per run.
+ *
+ * Events/s counts the two events every job is sure to have, its arrival
+ * and its completion, so RR rows do not get credit for quantum expiries.
+ * Peak RSS is the simulator's own, as reported by wait4().
+ */
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-n <jobs>] [-c <cores>] [-s <schemes>] [-l] [-- <tracegen options>]\n", program_name);
+	fprintf(stderr, "       %s -n 1000,10000000 -c 1,1024 -s fcfs,rr4 -- -a bursty -r pareto\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -n  comma separated trace sizes (default 1000,10000,100000,1000000)\n");
+	fprintf(stderr, "  -c  comma separated core counts (default 1,4,16,64,256,1024)\n");
+	fprintf(stderr, "  -s  comma separated schemes (default fcfs,sjf,psjf,pri,ppri,rr4)\n");
+	fprintf(stderr, "  -l  run the simulator in streaming mode (-l)\n");
+	fprintf(stderr, "  anything after -- is passed on to tracegen\n");
+}
+
+/*
+ * Runs argv[0] with stdout sent to /dev/null and waits for it.  Returns its
+ * exit status, or -1 if it could not be run; usage and seconds get its
+ * resource use and wall time.
+ */
+int run_program(char **args, struct rusage *usage, double *seconds)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int null = open("/dev/null", O_WRONLY);
+		if (null >= 0)
+			dup2(null, STDOUT_FILENO);
+		execv(args[0], args);
+		_exit(127);
+	}
+
+	int status;
+	if (pid < 0 || wait4(pid, &status, 0, usage) < 0)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * Splits a comma separated list in place into at most max items.  Returns
+ * the number of items.
+ */
+int split_list(char *list, char **items, int max)
+{
+	int count = 0;
+	for (char *item = strtok(list, ","); item != NULL && count < max; item = strtok(NULL, ","))
+		items[count++] = item;
+	return count;
+}
+
+#define MAX_ITEMS 64
+
+int main(int argc, char **argv)
+{
+	int c, streaming = 0;
+	char sizes[256] = "1000,10000,100000,1000000";
+	char cores[256] = "1,4,16,64,256,1024";
+	char schemes[256] = "fcfs,sjf,psjf,pri,ppri,rr4";
+
+	while ((c = getopt(argc, argv, "n:c:s:l")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+			case 'c': snprintf(cores, sizeof(cores), "%s", optarg); break;
+			case 's': snprintf(schemes, sizeof(schemes), "%s", optarg); break;
+			case 'l': streaming = 1; break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	char *size_list[MAX_ITEMS], *core_list[MAX_ITEMS], *scheme_list[MAX_ITEMS];
+	int num_sizes = split_list(sizes, size_list, MAX_ITEMS);
+	int num_cores = split_list(cores, core_list, MAX_ITEMS);
+	int num_schemes = split_list(schemes, scheme_list, MAX_ITEMS);
+
+	char dir[] = "/tmp/scalebench.XXXXXX";
+	if (mkdtemp(dir) == NULL)
+	{
+		fprintf(stderr, "Unable to create a directory for the traces.\n");
+		return 2;
+	}
+
+	printf("\"Jobs\",\"Scheme\",\"Cores\",\"Wall s\",\"Events/s\",\"Peak RSS KB\"\n");
+	fflush(stdout);
+
+	int failed = 0;
+	for (int i = 0; i < num_sizes; i++)
+	{
+		long jobs = atol(size_list[i]);
+		char trace[64];
+		snprintf(trace, sizeof(trace), "%s/trace.bin", dir);
+
+		//./tracegen -n <jobs> -b -o <trace> <extra options>
+		char *gen_args[8 + MAX_ITEMS] = { "./tracegen", "-n", size_list[i], "-b", "-o", trace };
+		int num_gen = 6;
+		for (int a = optind; a < argc && num_gen < 7 + MAX_ITEMS; a++)
+			gen_args[num_gen++] = argv[a];
+		gen_args[num_gen] = NULL;
+
+		struct rusage usage;
+		double seconds;
+		if (jobs <= 0 || run_program(gen_args, &usage, &seconds) != 0)
+		{
+			fprintf(stderr, "Unable to generate a trace of %s jobs.\n", size_list[i]);
+			failed++;
+			continue;
+		}
+
+		for (int s = 0; s < num_schemes; s++)
+		{
+			for (int k = 0; k < num_cores; k++)
+			{
+				char *sim_args[] = { "./simulator", "-e", "-q", "-c", core_list[k], "-s", scheme_list[s], trace, NULL, NULL };
+				if (streaming)
+				{
+					sim_args[8] = trace;
+					sim_args[7] = "-l";
+				}
+
+				int status = run_program(sim_args, &usage, &seconds);
+				if (status != 0)
+				{
+					fprintf(stderr, "simulator -c %s -s %s on %ld jobs failed (%d).\n", core_list[k], scheme_list[s], jobs, status);
+					failed++;
+					continue;
+				}
+				printf("%ld,%s,%s,%.4f,%.0f,%ld\n", jobs, scheme_list[s], core_list[k], seconds,
+					seconds > 0 ? 2.0 * jobs / seconds : 0.0, usage.ru_maxrss);
+				fflush(stdout);
+			}
+		}
+		unlink(trace);
+	}
+	rmdir(dir);
+
+	return failed ? 3 : 0;
+}
@@ -1,41 +1,842 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "libscheduler/libscheduler.h"
+#include "libpriqueue/libpriqueue_typed.h"
+#include "libtrace/libtrace.h"
 
 
+/*
+ * Output levels selected with -q / -v.  Each level prints everything the
+ * levels below it print.
+ */
+enum
+{
+	VERBOSE_QUIET = 0,  // the three averages only
+	VERBOSE_DIAGRAM,    // plus the final timing diagram
+	VERBOSE_EVENTS,     // plus the banner and every scheduling event
+	VERBOSE_TICKS       // plus the full state after every time unit (default)
+};
+
+// Long options, which have no single-letter form
+enum
+{
+	OPTION_CHECKPOINT_AT = 256,
+	OPTION_CHECKPOINT_EVERY,
+	OPTION_CHECKPOINT_FILE,
+	OPTION_RESTORE
+};
+
+// All of stdout goes through this one buffer and is flushed in large writes.
+static char output_buffer[1 << 20];
+
 typedef struct _simulator_job_list_t
 {
 	int job_id, arrival_time, run_time, priority;
 	int core_id, arrived;
 } simulator_job_list_t;
 
+/*
+ * The timing diagram is kept run-length encoded: one segment per stretch of
+ * time a core spends on the same job (or idle, job_id == -1), so memory grows
+ * with context switches rather than with simulated time.
+ */
+typedef struct _simulator_segment_t
+{
+	int job_id, start, length;
+} simulator_segment_t;
+
+typedef struct _simulator_diagram_t
+{
+	simulator_segment_t *segments;
+	int count, capacity;
+} simulator_diagram_t;
+
+void diagram_append(simulator_diagram_t *diagram, int job_id, int start, int length)
+{
+	if (diagram->count > 0 && diagram->segments[diagram->count - 1].job_id == job_id)
+	{
+		diagram->segments[diagram->count - 1].length += length;
+		return;
+	}
+
+	if (diagram->count == diagram->capacity)
+	{
+		diagram->capacity = diagram->capacity ? diagram->capacity * 2 : 16;
+		diagram->segments = realloc(diagram->segments, diagram->capacity * sizeof(simulator_segment_t));
+
+		if (diagram->segments == NULL)
+		{
+			fprintf(stderr, "Out of memory.\n");
+			exit(3);
+		}
+	}
+
+	simulator_segment_t *segment = &diagram->segments[diagram->count++];
+	segment->job_id = job_id;
+	segment->start = start;
+	segment->length = length;
+}
+
+/*
+ * Renders one core's diagram in the classic one-symbol-per-time-unit format.
+ */
+void print_diagram(int core_id, simulator_diagram_t *diagram)
+{
+	int i, t;
+	printf("  Core %2d: ", core_id);
+
+	for (i = 0; i < diagram->count; i++)
+	{
+		char label[16];
+		int job_id = diagram->segments[i].job_id;
+
+		if (job_id == -1)
+			strcpy(label, "-");
+		else if (job_id < 10)
+			sprintf(label, "%d", job_id);
+		else if (job_id < 10 + 26)
+			sprintf(label, "%c", job_id - 10 + 'a');
+		else if (job_id < 10 + 26 + 26)
+			sprintf(label, "%c", job_id - 10 - 26 + 'A');
+		else
+		{
+			snprintf(label, sizeof(label), "(%d)", job_id);
+			label[9] = '\0';  // Same 9-symbol cap the per-tick strings always had
+		}
+
+		size_t label_len = strlen(label);
+		for (t = 0; t < diagram->segments[i].length; t++)
+			fwrite(label, 1, label_len, stdout);
+	}
+
+	printf("\n");
+}
+
+/*
+ * Writes every segment as a "core,job,start,length" CSV row.
+ */
+int dump_diagrams(const char *file_name, simulator_diagram_t *diagrams, int cores)
+{
+	FILE *file = fopen(file_name, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", file_name);
+		return 0;
+	}
+
+	int i, j;
+	fprintf(file, "\"Core\",\"Job\",\"Start\",\"Length\"\n");
+	for (i = 0; i < cores; i++)
+		for (j = 0; j < diagrams[i].count; j++)
+			fprintf(file, "%d,%d,%d,%d\n", i, diagrams[i].segments[j].job_id,
+					diagrams[i].segments[j].start, diagrams[i].segments[j].length);
+
+	fclose(file);
+	return 1;
+}
+
+/*
+ * Prints the p50/p90/p99/max of each per-job time over all jobs, then for
+ * each priority that had jobs.
+ */
+void print_percentiles()
+{
+	static const char *names[SCHEDULER_METRICS] = { "Waiting Time", "Turnaround Time", "Response Time" };
+	scheduler_percentiles_t p;
+	int m, priority;
+
+	for (m = 0; m < SCHEDULER_METRICS; m++)
+	{
+		scheduler_percentiles(m, SCHEDULER_ALL_PRIORITIES, &p);
+		printf("%s Percentiles: p50 %.2f, p90 %.2f, p99 %.2f, max %d\n", names[m], p.p50, p.p90, p.p99, p.max);
+	}
+
+	for (priority = 0; priority <= SCHEDULER_PRIORITY_LEVELS; priority++)
+	{
+		int which = priority < SCHEDULER_PRIORITY_LEVELS ? priority : SCHEDULER_OTHER_PRIORITIES;
+		long long count = scheduler_percentiles(SCHEDULER_WAITING, which, &p);
+		if (count == 0)
+			continue;
+
+		if (which == SCHEDULER_OTHER_PRIORITIES)
+			printf("  Other priorities (%lld jobs):\n", count);
+		else
+			printf("  Priority %d (%lld jobs):\n", priority, count);
+		for (m = 0; m < SCHEDULER_METRICS; m++)
+		{
+			scheduler_percentiles(m, which, &p);
+			printf("    %s: p50 %.2f, p90 %.2f, p99 %.2f, max %d\n", names[m], p.p50, p.p90, p.p99, p.max);
+		}
+	}
+}
+
 void print_usage(char *program_name)
 {
-	fprintf(stderr, "Usage: %s -c <cores> -s <scheme> <input file>\n", program_name);
+	fprintf(stderr, "Usage: %s [-e] [-l] [-R] [-p] [-M] [-S] [-q | -v <level>] [-d <file>] [-Q <quanta>] [-B <period>] [-L <latency>] [-C <costs>] [-A <window>] -c <cores> -s <scheme> <input file>\n", program_name);
+	fprintf(stderr, "       %s [options] [-s <scheme>] --restore <snapshot>\n", program_name);
 	fprintf(stderr, "       %s -c 2 -s fcfs examples/proc1.csv\n", program_name);
+	fprintf(stderr, "       (an input file of - reads the trace from stdin)\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Acceptable schemes are: fcfs, sjf, psjf, pri, ppri, rr#\n");
+	fprintf(stderr, "Acceptable schemes are: fcfs, sjf, psjf, pri, ppri, rr#, mlfq, cfs\n");
+	fprintf(stderr, "  -e  event-driven: jump straight to the next arrival, completion or quantum expiry\n");
+	fprintf(stderr, "  -l  stream the trace instead of loading it, keeping only live jobs in memory\n");
+	fprintf(stderr, "      (the trace must be sorted by arrival time; jobs finishing or arriving in the same time\n");
+	fprintf(stderr, "      unit go in arrival, then job_id order, so their times and the averages can differ\n");
+	fprintf(stderr, "      from a loaded run)\n");
+	fprintf(stderr, "  -R  give every core its own ready queue, idle cores stealing from the busiest\n");
+	fprintf(stderr, "  -M  print the makespan, steals, migrations, ready queue operations and cost model overhead after the averages\n");
+	fprintf(stderr, "  -p  print p50/p90/p99/max of each time after the averages, overall and per priority\n");
+	fprintf(stderr, "  -S  print scheduler statistics after the averages (needs a make STATS=1 build)\n");
+	fprintf(stderr, "  -q  quiet: only print the final averages (same as -v 0)\n");
+	fprintf(stderr, "  -v  output level: 0 averages, 1 +timing diagram, 2 +events, 3 +every time unit (default)\n");
+	fprintf(stderr, "  -Q  comma separated MLFQ quantum of each level, top level first (default 2,4,8)\n");
+	fprintf(stderr, "  -B  MLFQ boost period, 0 for none (default 100)\n");
+	fprintf(stderr, "  -L  CFS target latency and, optionally, minimum granularity: latency[,granularity] (default 24,3)\n");
+	fprintf(stderr, "  -C  time a dispatch costs: switch,socket,numa[,cores per socket] for resuming on the same core,\n");
+	fprintf(stderr, "      moving within a socket and moving across sockets (default 0,0,0, one socket)\n");
+	fprintf(stderr, "  -A  fcfs/rr: look this many jobs into the queue for one that last ran on the core (default 0)\n");
+	fprintf(stderr, "  -d  also write the timing diagram to <file> as core,job,start,length segments\n");
+	fprintf(stderr, "  --checkpoint-at <time>      write a snapshot to the --checkpoint-file when time reaches <time>\n");
+	fprintf(stderr, "  --checkpoint-every <events> write one every <events> scheduler events, replacing the last\n");
+	fprintf(stderr, "  --checkpoint-file <file>    where snapshots go (not with -l)\n");
+	fprintf(stderr, "  --restore <snapshot>        carry on from a snapshot instead of a trace; cores and jobs come from it,\n");
+	fprintf(stderr, "                              -s switches to another scheme and -Q, -B, -L, -C, -A replace its settings\n");
+}
+
+/*
+ * Lookup structures over the jobs array, so each time unit only looks at the
+ * jobs that actually have something happening to them.
+ */
+typedef struct _simulator_index_t
+{
+	int num_jobs;
+	int *slot_of;        // job_id -> slot in the jobs array, -1 once finished
+	int *arrival_order;  // job_ids sorted by arrival time
+	int next_arrival;    // first entry of arrival_order that has not arrived yet
+	int *core_job;       // job_id running on each core, -1 when idle
+	struct _simulator_stream_t *stream;  // set in streaming mode (-l)
+} simulator_index_t;
+
+/*
+ * Streaming mode (-l) reads the trace a batch at a time instead of loading it,
+ * so the jobs array only ever holds jobs that have arrived and not finished.
+ * The trace must then be sorted by arrival time, and slot_of becomes a small
+ * hash table over the live job_ids.
+ *
+ * Loaded mode handles jobs that finish or arrive on the same time unit in the
+ * order of their slots in the jobs array, which holds every job of the trace
+ * and fills a finished job's slot with the last one, often a job yet to
+ * arrive.  Following those moves without the whole array would mean keeping
+ * every displaced job that has not arrived, so streaming orders such ties by
+ * arrival time, then job_id, instead.  When several jobs finish or arrive on
+ * the same time unit, -l can therefore put them on other cores than loaded
+ * mode does, and its per-job times and averages can differ.
+ */
+#define STREAM_BATCH 4096
+
+typedef struct _simulator_stream_t
+{
+	trace_reader_t reader;
+	trace_job_t batch[STREAM_BATCH];
+	int count, next;     // jobs in batch, first one not handed out yet
+	int last_arrival;
+	int unsorted;        // an arrival went back in time
+	int *keys, *slots;   // open-addressed job_id -> slot table, key -1 when empty
+	int capacity, used;
+} simulator_stream_t;
+
+typedef struct _simulator_arrival_t
+{
+	int arrival_time, job_id;
+} simulator_arrival_t;
+
+int compare_arrivals(const void *a, const void *b)
+{
+	const simulator_arrival_t *x = a, *y = b;
+	if (x->arrival_time != y->arrival_time)
+		return (x->arrival_time < y->arrival_time) ? -1 : 1;
+	return x->job_id - y->job_id;
 }
 
-int set_active_job(int job_id, int core_id, simulator_job_list_t *jobs, int active_jobs)
+void build_index(simulator_index_t *index, simulator_job_list_t *jobs, int num_jobs, int cores)
 {
 	int i;
-	for (i = 0; i < active_jobs; i++)
+	simulator_arrival_t *arrivals = malloc((num_jobs + 1) * sizeof(simulator_arrival_t));
+
+	index->num_jobs = num_jobs;
+	index->slot_of = malloc((num_jobs + 1) * sizeof(int));
+	index->arrival_order = malloc((num_jobs + 1) * sizeof(int));
+	index->next_arrival = 0;
+	index->core_job = malloc(cores * sizeof(int));
+	index->stream = NULL;
+
+	for (i = 0; i < num_jobs; i++)
 	{
-		if (jobs[i].job_id == job_id && jobs[i].arrived)
+		index->slot_of[jobs[i].job_id] = i;
+		arrivals[i].arrival_time = jobs[i].arrival_time;
+		arrivals[i].job_id = jobs[i].job_id;
+	}
+
+	qsort(arrivals, num_jobs, sizeof(simulator_arrival_t), compare_arrivals);
+	for (i = 0; i < num_jobs; i++)
+		index->arrival_order[i] = arrivals[i].job_id;
+
+	for (i = 0; i < cores; i++)
+		index->core_job[i] = -1;
+
+	free(arrivals);
+}
+
+void free_index(simulator_index_t *index)
+{
+	free(index->slot_of);
+	free(index->arrival_order);
+	free(index->core_job);
+}
+
+int open_stream(simulator_stream_t *stream, const char *file_name, simulator_index_t *index, int cores)
+{
+	int i;
+	trace_status_t status = trace_reader_open(&stream->reader, file_name);
+	if (status != TRACE_OK)
+		return status;
+
+	stream->count = stream->next = 0;
+	stream->last_arrival = INT_MIN;
+	stream->unsorted = 0;
+	stream->capacity = 1024;
+	stream->used = 0;
+	stream->keys = malloc(stream->capacity * sizeof(int));
+	stream->slots = malloc(stream->capacity * sizeof(int));
+	for (i = 0; i < stream->capacity; i++)
+		stream->keys[i] = -1;
+
+	index->num_jobs = 0;
+	index->slot_of = NULL;
+	index->arrival_order = NULL;
+	index->next_arrival = 0;
+	index->core_job = malloc(cores * sizeof(int));
+	index->stream = stream;
+
+	for (i = 0; i < cores; i++)
+		index->core_job[i] = -1;
+
+	return TRACE_OK;
+}
+
+void close_stream(simulator_stream_t *stream)
+{
+	trace_reader_close(&stream->reader);
+	free(stream->keys);
+	free(stream->slots);
+}
+
+/*
+ * Returns the next job of the trace without taking it, or NULL once the trace
+ * is exhausted (or turned out to be malformed or unsorted).
+ */
+trace_job_t *stream_peek(simulator_stream_t *stream)
+{
+	if (stream->next == stream->count)
+	{
+		if (stream->unsorted)
+			return NULL;
+
+		stream->count = trace_reader_next(&stream->reader, stream->batch, STREAM_BATCH);
+		stream->next = 0;
+		if (stream->count <= 0)
 		{
-			jobs[i].core_id = core_id;
-			return 1;
+			stream->count = 0;
+			return NULL;
 		}
 	}
 
+	trace_job_t *job = &stream->batch[stream->next];
+	if (job->arrival_time < stream->last_arrival)
+	{
+		stream->unsorted = 1;
+		stream->count = stream->next;
+		return NULL;
+	}
+
+	stream->last_arrival = job->arrival_time;
+	return job;
+}
+
+static unsigned int stream_hash(simulator_stream_t *stream, int job_id)
+{
+	return ((unsigned int)job_id * 2654435761u) & (stream->capacity - 1);
+}
+
+static void stream_insert(simulator_stream_t *stream, int job_id, int slot)
+{
+	unsigned int h = stream_hash(stream, job_id);
+	while (stream->keys[h] != -1 && stream->keys[h] != job_id)
+		h = (h + 1) & (stream->capacity - 1);
+
+	if (stream->keys[h] == -1)
+		stream->used++;
+	stream->keys[h] = job_id;
+	stream->slots[h] = slot;
+}
+
+static void stream_grow(simulator_stream_t *stream)
+{
+	int i, old_capacity = stream->capacity;
+	int *old_keys = stream->keys, *old_slots = stream->slots;
+
+	stream->capacity *= 2;
+	stream->used = 0;
+	stream->keys = malloc(stream->capacity * sizeof(int));
+	stream->slots = malloc(stream->capacity * sizeof(int));
+	for (i = 0; i < stream->capacity; i++)
+		stream->keys[i] = -1;
+
+	for (i = 0; i < old_capacity; i++)
+		if (old_keys[i] != -1)
+			stream_insert(stream, old_keys[i], old_slots[i]);
+
+	free(old_keys);
+	free(old_slots);
+}
+
+/*
+ * Deletes job_id from the table, shifting back any later entry of the same
+ * probe run so lookups never stop at the hole.
+ */
+static void stream_erase(simulator_stream_t *stream, int job_id)
+{
+	unsigned int mask = stream->capacity - 1, h = stream_hash(stream, job_id), next;
+	while (stream->keys[h] != job_id)
+	{
+		if (stream->keys[h] == -1)
+			return;
+		h = (h + 1) & mask;
+	}
+
+	for (next = (h + 1) & mask; stream->keys[next] != -1; next = (next + 1) & mask)
+	{
+		unsigned int home = stream_hash(stream, stream->keys[next]);
+		if (((next - home) & mask) >= ((next - h) & mask))
+		{
+			stream->keys[h] = stream->keys[next];
+			stream->slots[h] = stream->slots[next];
+			h = next;
+		}
+	}
+
+	stream->keys[h] = -1;
+	stream->used--;
+}
+
+/*
+ * Slot of job_id in the jobs array, -1 once it has finished.
+ */
+static inline int job_slot(simulator_index_t *index, int job_id)
+{
+	if (!index->stream)
+		return index->slot_of[job_id];
+
+	simulator_stream_t *stream = index->stream;
+	unsigned int h = stream_hash(stream, job_id);
+	while (stream->keys[h] != -1)
+	{
+		if (stream->keys[h] == job_id)
+			return stream->slots[h];
+		h = (h + 1) & (stream->capacity - 1);
+	}
+	return -1;
+}
+
+static void set_job_slot(simulator_index_t *index, int job_id, int slot)
+{
+	if (!index->stream)
+		index->slot_of[job_id] = slot;
+	else if (slot == -1)
+		stream_erase(index->stream, job_id);
+	else
+	{
+		if (2 * (index->stream->used + 1) > index->stream->capacity)
+			stream_grow(index->stream);
+		stream_insert(index->stream, job_id, slot);
+	}
+}
+
+/*
+ * Whether job a is handled before job b when both finish or arrive on the
+ * same time unit: the lower jobs-array slot first in loaded mode, the earlier
+ * arrival, then the lower job_id, when streaming.
+ */
+static int handled_before(simulator_job_list_t *jobs, simulator_index_t *index, int a, int b)
+{
+	if (!index->stream)
+		return index->slot_of[a] < index->slot_of[b];
+
+	int arrival_a = jobs[job_slot(index, a)].arrival_time, arrival_b = jobs[job_slot(index, b)].arrival_time;
+	return arrival_a != arrival_b ? arrival_a < arrival_b : a < b;
+}
+
+/*
+ * Removes the job in the given slot by moving the last active job into it.
+ */
+void remove_job(int slot, simulator_job_list_t *jobs, simulator_index_t *index, int *active_jobs)
+{
+	set_job_slot(index, jobs[slot].job_id, -1);
+	(*active_jobs)--;
+
+	if (slot != *active_jobs)
+	{
+		memcpy(&jobs[slot], &jobs[*active_jobs], sizeof(simulator_job_list_t));
+		set_job_slot(index, jobs[slot].job_id, slot);
+	}
+}
+
+int set_active_job(int job_id, int core_id, simulator_job_list_t *jobs, simulator_index_t *index)
+{
+	if (job_id < 0 || job_id >= index->num_jobs || job_slot(index, job_id) == -1)
+		return 0;
+
+	simulator_job_list_t *job = &jobs[job_slot(index, job_id)];
+	if (!job->arrived)
+		return 0;
+
+	if (job->core_id != -1 && index->core_job[job->core_id] == job_id)
+		index->core_job[job->core_id] = -1;
+
+	job->core_id = core_id;
+	index->core_job[core_id] = job_id;
+	return 1;
+}
+
+/*
+ * A snapshot (--checkpoint-at, --checkpoint-every, --restore) holds the state
+ * at the top of a time unit: this header, the jobs array in slot order, the
+ * arrival order, what each core runs, the quantum clocks and the timing
+ * diagram segments, then the scheduler's own state from scheduler_save().
+ * Fields are in native byte order, like the scheduler's.
+ */
+#define SNAPSHOT_MAGIC   "SIMSNAPS"
+#define SNAPSHOT_VERSION 1
+
+typedef struct _simulator_snapshot_t
+{
+	int time, scheme, quantum, cores;
+	int num_jobs, active_jobs, jobs_alive;
+} simulator_snapshot_t;
+
+static int write_all(FILE *file, const void *data, size_t size, size_t count)
+{
+	return count == 0 || fwrite(data, size, count, file) == count;
+}
+
+static int read_all(FILE *file, void *data, size_t size, size_t count)
+{
+	return count == 0 || fread(data, size, count, file) == count;
+}
+
+/*
+ * Writes a snapshot to <file>.tmp and renames it over file_name, so a crash
+ * while writing leaves the previous snapshot in place.  Returns 1 on success.
+ */
+int save_snapshot(const char *file_name, simulator_snapshot_t *state, simulator_job_list_t *jobs, simulator_index_t *index,
+		int *quantum_clock, simulator_diagram_t *diagrams)
+{
+	char temp_name[PATH_MAX];
+	int i, version = SNAPSHOT_VERSION;
+	snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name);
+
+	FILE *file = fopen(temp_name, "wb");
+	if (file == NULL)
+		return 0;
+
+	int ok = write_all(file, SNAPSHOT_MAGIC, 8, 1) && write_all(file, &version, sizeof(int), 1) &&
+		write_all(file, state, sizeof(*state), 1) &&
+		write_all(file, jobs, sizeof(simulator_job_list_t), state->active_jobs) &&
+		write_all(file, &index->next_arrival, sizeof(int), 1) &&
+		write_all(file, index->arrival_order, sizeof(int), state->num_jobs) &&
+		write_all(file, index->core_job, sizeof(int), state->cores) &&
+		write_all(file, quantum_clock, sizeof(int), state->cores);
+
+	for (i = 0; ok && i < state->cores; i++)
+		ok = write_all(file, &diagrams[i].count, sizeof(int), 1) &&
+			write_all(file, diagrams[i].segments, sizeof(simulator_segment_t), diagrams[i].count);
+
+	ok = ok && scheduler_save(file);
+	if (fclose(file) != 0)
+		ok = 0;
+
+	if (ok && rename(temp_name, file_name) == 0)
+		return 1;
+
+	remove(temp_name);
 	return 0;
 }
 
+/*
+ * Frees what load_snapshot() allocated before it gave up.
+ */
+static void free_snapshot(simulator_snapshot_t *state, simulator_job_list_t **jobs, simulator_index_t *index,
+		int **quantum_clock, simulator_diagram_t **diagrams)
+{
+	int i;
+	if (*diagrams)
+		for (i = 0; i < state->cores; i++)
+			free((*diagrams)[i].segments);
+
+	free(*jobs);
+	free_index(index);
+	free(*quantum_clock);
+	free(*diagrams);
+	*jobs = NULL;
+	*quantum_clock = NULL;
+	*diagrams = NULL;
+}
+
+/*
+ * Reads a snapshot back, allocating the jobs array, the index, the quantum
+ * clocks and the diagrams, and restores the scheduler with the given scheme
+ * (-1 for the saved one).  On failure nothing is left allocated.
+ */
+trace_status_t load_snapshot(const char *file_name, int scheme, simulator_snapshot_t *state, simulator_job_list_t **jobs,
+		simulator_index_t *index, int **quantum_clock, simulator_diagram_t **diagrams)
+{
+	char magic[8];
+	int i, version;
+	FILE *file = fopen(file_name, "rb");
+	if (file == NULL)
+		return TRACE_ERR_OPEN;
+
+	if (!read_all(file, magic, 8, 1) || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+		!read_all(file, &version, sizeof(int), 1) || version != SNAPSHOT_VERSION ||
+		!read_all(file, state, sizeof(*state), 1) || state->cores <= 0 || state->num_jobs < 0 ||
+		state->active_jobs < 0 || state->active_jobs > state->num_jobs || state->scheme < FCFS || state->scheme > CFS)
+	{
+		fclose(file);
+		return TRACE_ERR_FORMAT;
+	}
+
+	*jobs = malloc((state->num_jobs + 1) * sizeof(simulator_job_list_t));
+	index->num_jobs = state->num_jobs;
+	index->slot_of = malloc((state->num_jobs + 1) * sizeof(int));
+	index->arrival_order = malloc((state->num_jobs + 1) * sizeof(int));
+	index->core_job = malloc(state->cores * sizeof(int));
+	index->stream = NULL;
+	*quantum_clock = malloc(state->cores * sizeof(int));
+	*diagrams = calloc(state->cores, sizeof(simulator_diagram_t));
+	if (!*jobs || !index->slot_of || !index->arrival_order || !index->core_job || !*quantum_clock || !*diagrams)
+	{
+		fclose(file);
+		free_snapshot(state, jobs, index, quantum_clock, diagrams);
+		return TRACE_ERR_MEMORY;
+	}
+
+	int ok = read_all(file, *jobs, sizeof(simulator_job_list_t), state->active_jobs) &&
+		read_all(file, &index->next_arrival, sizeof(int), 1) &&
+		read_all(file, index->arrival_order, sizeof(int), state->num_jobs) &&
+		read_all(file, index->core_job, sizeof(int), state->cores) &&
+		read_all(file, *quantum_clock, sizeof(int), state->cores) &&
+		index->next_arrival >= 0 && index->next_arrival <= state->num_jobs;
+
+	for (i = 0; ok && i < state->num_jobs; i++)
+		ok = index->arrival_order[i] >= 0 && index->arrival_order[i] < state->num_jobs;
+	for (i = 0; ok && i < state->cores; i++)
+		ok = index->core_job[i] >= -1 && index->core_job[i] < state->num_jobs;
+
+	// Slots of finished jobs stay -1, the rest come from the jobs array
+	for (i = 0; i < state->num_jobs; i++)
+		index->slot_of[i] = -1;
+	for (i = 0; ok && i < state->active_jobs; i++)
+	{
+		ok = (*jobs)[i].job_id >= 0 && (*jobs)[i].job_id < state->num_jobs && index->slot_of[(*jobs)[i].job_id] == -1 &&
+			(*jobs)[i].core_id >= -1 && (*jobs)[i].core_id < state->cores;
+		if (ok)
+			index->slot_of[(*jobs)[i].job_id] = i;
+	}
+	for (i = 0; ok && i < state->cores; i++)
+		ok = index->core_job[i] == -1 || index->slot_of[index->core_job[i]] != -1;
+
+	for (i = 0; ok && i < state->cores; i++)
+	{
+		simulator_diagram_t *diagram = &(*diagrams)[i];
+		ok = read_all(file, &diagram->count, sizeof(int), 1) && diagram->count >= 0;
+		if (ok && diagram->count > 0)
+		{
+			diagram->capacity = diagram->count;
+			diagram->segments = malloc(diagram->capacity * sizeof(simulator_segment_t));
+			ok = diagram->segments && read_all(file, diagram->segments, sizeof(simulator_segment_t), diagram->count);
+		}
+	}
+
+	ok = ok && scheduler_restore(file, scheme == -1 ? state->scheme : scheme);
+	fclose(file);
+	if (!ok)
+	{
+		free_snapshot(state, jobs, index, quantum_clock, diagrams);
+		return TRACE_ERR_FORMAT;
+	}
+	return TRACE_OK;
+}
+
+/*
+ * Event-driven mode (-e) keeps the time each busy core's job completes or has
+ * its quantum expire in a min-heap, so the next event is found without
+ * looking at every core.  Every event moves the core it happens on to the
+ * changed list, and only those cores get a new entry before the next lookup.
+ * Running time off every busy core shifts none of these times, so an entry
+ * stays right until its core changes; one that no longer matches its core is
+ * dropped when it reaches the top.
+ *
+ * An entry costs a few heap steps, while a pass over the cores is a run of
+ * cheap checks, so once more than one core in 64 has changed since the last
+ * lookup (always, under 64 cores; often under round robin, whose quanta
+ * expire together) the lookup scans them instead and leaves the heap to be
+ * rebuilt when changes are sparse again.
+ */
+typedef struct _simulator_event_t
+{
+	int time, core;
+} simulator_event_t;
+
+static inline int compare_event_times(const simulator_event_t *a, const simulator_event_t *b, void *user)
+{
+	return (a->time > b->time) - (a->time < b->time);
+}
+
+PRIQUEUE_DEFINE(event_heap, simulator_event_t, compare_event_times)
+
+typedef struct _simulator_calendar_t
+{
+	event_heap_t heap;
+	int *changed;       // cores with an event since the last lookup
+	char *is_changed;
+	int changed_ct;
+	int complete;       // the heap holds an entry for every busy core
+	simulator_event_t *rebuild;
+} simulator_calendar_t;
+
+void calendar_init(simulator_calendar_t *calendar, int cores)
+{
+	event_heap_init(&calendar->heap, cores, NULL);
+	calendar->changed = malloc(cores * sizeof(int));
+	calendar->is_changed = calloc(cores, 1);
+	calendar->changed_ct = 0;
+	calendar->complete = 0;
+	calendar->rebuild = malloc(cores * sizeof(simulator_event_t));
+}
+
+void calendar_free(simulator_calendar_t *calendar)
+{
+	event_heap_destroy(&calendar->heap);
+	free(calendar->changed);
+	free(calendar->is_changed);
+	free(calendar->rebuild);
+}
+
+/*
+ * Notes that core got a new job or quantum, or lost its job.
+ */
+static inline void calendar_touch(simulator_calendar_t *calendar, int core)
+{
+	if (!calendar->is_changed[core])
+	{
+		calendar->is_changed[core] = 1;
+		calendar->changed[calendar->changed_ct++] = core;
+	}
+}
+
+/*
+ * When the job on core completes or has its quantum expire, -1 for an idle core.
+ */
+static inline int core_event_time(int time, int core, simulator_job_list_t *jobs, simulator_index_t *index, int *quantum_clock, int scheme)
+{
+	if (index->core_job[core] == -1)
+		return -1;
+
+	int event = time + jobs[job_slot(index, index->core_job[core])].run_time;
+	if ((scheme == RR || scheme == MLFQ || scheme == CFS) && time + quantum_clock[core] < event)
+		event = time + quantum_clock[core];
+	return event;
+}
+
+/*
+ * Returns how many time units, starting with the current one, can run before
+ * the next event: a pending arrival, a running job completing, or (for RR,
+ * MLFQ and CFS) a running job's quantum expiring. Nothing can change between
+ * those events, so the main loop may run them as a single batch.
+ */
+int ticks_until_next_event(int time, simulator_job_list_t *jobs, simulator_index_t *index, int cores, int *quantum_clock, int scheme,
+		simulator_calendar_t *calendar)
+{
+	int i, next = -1;
+	simulator_event_t top;
+
+	if (index->stream)
+	{
+		trace_job_t *pending = stream_peek(index->stream);
+		if (pending)
+			next = pending->arrival_time;
+	}
+	else if (index->next_arrival < index->num_jobs)
+		next = jobs[index->slot_of[index->arrival_order[index->next_arrival]]].arrival_time;
+
+	for (i = 0; i < calendar->changed_ct; i++)
+		calendar->is_changed[calendar->changed[i]] = 0;
+
+	if (calendar->changed_ct > cores / 64)
+	{
+		calendar->changed_ct = 0;
+		calendar->complete = 0;
+		for (i = 0; i < cores; i++)
+		{
+			int event = core_event_time(time, i, jobs, index, quantum_clock, scheme);
+			if (event != -1 && (next == -1 || event < next))
+				next = event;
+		}
+		return (next > time) ? next - time : 1;
+	}
+
+	// Stale entries only leave from the top, so start over once they outnumber the cores
+	if (!calendar->complete || event_heap_size(&calendar->heap) + calendar->changed_ct > 2 * cores + 16)
+	{
+		int busy = 0;
+		for (i = 0; i < cores; i++)
+		{
+			simulator_event_t event = { core_event_time(time, i, jobs, index, quantum_clock, scheme), i };
+			if (event.time != -1)
+				calendar->rebuild[busy++] = event;
+		}
+		calendar->heap.size = 0;
+		event_heap_offer_all(&calendar->heap, calendar->rebuild, busy);
+		calendar->complete = 1;
+	}
+	else
+	{
+		for (i = 0; i < calendar->changed_ct; i++)
+		{
+			int core = calendar->changed[i];
+			simulator_event_t event = { core_event_time(time, core, jobs, index, quantum_clock, scheme), core };
+			if (event.time != -1)
+				event_heap_offer(&calendar->heap, event);
+		}
+	}
+	calendar->changed_ct = 0;
+
+	while (event_heap_peek(&calendar->heap, &top) &&
+			core_event_time(time, top.core, jobs, index, quantum_clock, scheme) != top.time)
+		event_heap_poll(&calendar->heap, &top);
+
+	if (event_heap_size(&calendar->heap) > 0 && (next == -1 || top.time < next))
+		next = top.time;
+
+	return (next > time) ? next - time : 1;
+}
+
 void print_available_jobs(simulator_job_list_t *jobs, int active_jobs)
 {
 	printf("Active jobs are: ");
@@ -77,13 +878,30 @@ void print_available_cores(int cores)
 int main(int argc, char **argv)
 {
 	int c;
+	simulator_index_t index;
+	setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
 	int cores = 0, scheme = -1, quantum = 0;
-	char *file_name;
+	int mlfq_quanta[SCHEDULER_MLFQ_MAX_LEVELS] = { 2, 4, 8 }, mlfq_levels = 3, boost_period = 100;
+	int cfs_latency = 24, cfs_granularity = 3;
+	scheduler_cost_model_t costs = { 0, 0, 0, 0, 0 };
+	int event_driven = 0, streaming = 0, per_core = 0, show_counters = 0, show_percentiles = 0, show_stats = 0, verbosity = VERBOSE_TICKS;
+	int mlfq_given = 0, cfs_given = 0, costs_given = 0, checkpoint_at = -1, checkpoint_every = 0;
+	char *file_name, *dump_file = NULL, *checkpoint_file = NULL, *restore_file = NULL;
+
+	static const struct option long_options[] =
+	{
+		{ "checkpoint-at", required_argument, NULL, OPTION_CHECKPOINT_AT },
+		{ "checkpoint-every", required_argument, NULL, OPTION_CHECKPOINT_EVERY },
+		{ "checkpoint-file", required_argument, NULL, OPTION_CHECKPOINT_FILE },
+		{ "restore", required_argument, NULL, OPTION_RESTORE },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	/*
 	 * Parse command line options.
 	 */
-	while ((c = getopt(argc, argv, "c:s:")) != -1)
+	while ((c = getopt_long(argc, argv, "c:s:elRpMSqv:d:Q:B:L:C:A:", long_options, NULL)) != -1)
 	{
 		switch (c)
 		{
@@ -104,6 +922,8 @@ int main(int argc, char **argv)
 				else if (strcasecmp(optarg, "PSJF") == 0) { scheme = PSJF; }
 				else if (strcasecmp(optarg, "PRI") == 0) { scheme = PRI; }
 				else if (strcasecmp(optarg, "PPRI") == 0) { scheme = PPRI; }
+				else if (strcasecmp(optarg, "MLFQ") == 0) { scheme = MLFQ; }
+				else if (strcasecmp(optarg, "CFS") == 0) { scheme = CFS; }
 				else if (strncasecmp(optarg, "RR", 2) == 0)
 				{
 					scheme = RR;
@@ -118,6 +938,148 @@ int main(int argc, char **argv)
 				}
 				break;
 
+			case 'e':
+				event_driven = 1;
+				break;
+
+			case 'l':
+				streaming = 1;
+				break;
+
+			case 'R':
+				per_core = 1;
+				break;
+
+			case 'M':
+				show_counters = 1;
+				break;
+
+			case 'p':
+				show_percentiles = 1;
+				break;
+
+			case 'S':
+				show_stats = 1;
+				break;
+
+			case 'q':
+				verbosity = VERBOSE_QUIET;
+				break;
+
+			case 'v':
+				verbosity = atoi(optarg);
+
+				if (verbosity < VERBOSE_QUIET || verbosity > VERBOSE_TICKS)
+				{
+					fprintf(stderr, "Option -v <level> requires a level between %d and %d.\n", VERBOSE_QUIET, VERBOSE_TICKS);
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'd':
+				dump_file = optarg;
+				break;
+
+			case 'Q':
+			{
+				char *item = optarg, *end;
+				for (mlfq_levels = 0; *item; item = (*end == ',') ? end + 1 : end)
+				{
+					long q = strtol(item, &end, 10);
+					if (end == item || q <= 0 || mlfq_levels == SCHEDULER_MLFQ_MAX_LEVELS || (*end != ',' && *end != '\0'))
+					{
+						fprintf(stderr, "Option -Q <quanta> requires up to %d positive numbers. (Eg: -Q 2,4,8)\n", SCHEDULER_MLFQ_MAX_LEVELS);
+						print_usage(argv[0]);
+						return 1;
+					}
+					mlfq_quanta[mlfq_levels++] = (int)q;
+				}
+				mlfq_given = 1;
+				if (mlfq_levels == 0)
+				{
+					fprintf(stderr, "Option -Q <quanta> requires up to %d positive numbers. (Eg: -Q 2,4,8)\n", SCHEDULER_MLFQ_MAX_LEVELS);
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			}
+
+			case 'B':
+				boost_period = atoi(optarg);
+				mlfq_given = 1;
+
+				if (boost_period < 0)
+				{
+					fprintf(stderr, "Option -B <period> requires a number of at least 0.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'L':
+			{
+				int n = 0, got = sscanf(optarg, "%d%n,%d%n", &cfs_latency, &n, &cfs_granularity, &n);
+
+				if (got < 1 || optarg[n] != '\0' || cfs_latency <= 0 || cfs_granularity <= 0)
+				{
+					fprintf(stderr, "Option -L <latency> requires one or two positive numbers. (Eg: -L 24,3)\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				cfs_given = 1;
+				break;
+			}
+
+			case 'C':
+			{
+				int n = 0, got = sscanf(optarg, "%d,%d,%d%n,%d%n", &costs.switch_cost, &costs.socket_cost, &costs.numa_cost, &n, &costs.cores_per_socket, &n);
+
+				if (got < 3 || optarg[n] != '\0' || costs.switch_cost < 0 || costs.socket_cost < 0 || costs.numa_cost < 0 || costs.cores_per_socket < 0)
+				{
+					fprintf(stderr, "Option -C <costs> requires three or four numbers of at least 0. (Eg: -C 1,3,10,4)\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				costs_given = 1;
+				break;
+			}
+
+			case 'A':
+				costs.affinity_window = atoi(optarg);
+				costs_given = 1;
+
+				if (costs.affinity_window < 0)
+				{
+					fprintf(stderr, "Option -A <window> requires a number of at least 0.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case OPTION_CHECKPOINT_AT:
+			case OPTION_CHECKPOINT_EVERY:
+				if (atoi(optarg) < (c == OPTION_CHECKPOINT_AT ? 0 : 1))
+				{
+					fprintf(stderr, "Option --%s requires a number of at least %d.\n",
+							c == OPTION_CHECKPOINT_AT ? "checkpoint-at <time>" : "checkpoint-every <events>", c == OPTION_CHECKPOINT_AT ? 0 : 1);
+					print_usage(argv[0]);
+					return 1;
+				}
+				if (c == OPTION_CHECKPOINT_AT)
+					checkpoint_at = atoi(optarg);
+				else
+					checkpoint_every = atoi(optarg);
+				break;
+
+			case OPTION_CHECKPOINT_FILE:
+				checkpoint_file = optarg;
+				break;
+
+			case OPTION_RESTORE:
+				restore_file = optarg;
+				break;
+
 			case '?':
 				print_usage(argv[0]);
 				return 1;
@@ -128,25 +1090,46 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (cores == 0)
+	if (restore_file)
 	{
-		fprintf(stderr, "Required option -c <cores> is not present.\n");
-		print_usage(argv[0]);
-		return 1;
+		// The snapshot decides the cores, the queue layout and the jobs; -s is optional, to fork a variant
+		if (cores != 0 || per_core || streaming || optind != argc)
+		{
+			fprintf(stderr, "Option --restore <file> takes the place of -c, -l, -R and the input file.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		file_name = restore_file;
 	}
-
-	if (scheme == -1)
+	else
 	{
-		fprintf(stderr, "Required option -s <scheme> is not present.\n");
-		print_usage(argv[0]);
-		return 1;
+		if (cores == 0)
+		{
+			fprintf(stderr, "Required option -c <cores> is not present.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (scheme == -1)
+		{
+			fprintf(stderr, "Required option -s <scheme> is not present.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (optind == argc - 1)
+			file_name = argv[optind];
+		else
+		{
+			fprintf(stderr, "A single input file is required.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
 	}
 
-	if (optind == argc - 1)
-		file_name = argv[optind];
-	else
+	if ((checkpoint_at >= 0 || checkpoint_every > 0) != (checkpoint_file != NULL) || (checkpoint_file && streaming))
 	{
-		fprintf(stderr, "A single input file is required.\n");
+		fprintf(stderr, "Options --checkpoint-at and --checkpoint-every go with --checkpoint-file <file>, outside streaming mode (-l).\n");
 		print_usage(argv[0]);
 		return 1;
 	}
@@ -154,174 +1137,302 @@ int main(int argc, char **argv)
 
 	/*
 	 * Open the file, read the file, and populate the jobs data structure.
+	 *
+	 * In streaming mode the jobs array starts empty and grows only as far as the
+	 * number of jobs alive at once; jobs are read from the trace as they arrive.
 	 */
-	FILE *file = fopen(file_name, "r");
-	if (file == NULL)
+	trace_t trace;
+	simulator_stream_t *stream = NULL;
+	simulator_snapshot_t snapshot;
+	simulator_job_list_t *restored_jobs = NULL;
+	int *quantum_clock = NULL;
+	simulator_diagram_t *core_timing_diagram = NULL;
+	trace_status_t status;
+
+	if (restore_file)
+		status = load_snapshot(restore_file, scheme, &snapshot, &restored_jobs, &index, &quantum_clock, &core_timing_diagram);
+	else if (streaming)
 	{
-		fprintf(stderr, "Unable to open file \"%s\".\n", file_name);
-		return 2;
+		stream = malloc(sizeof(simulator_stream_t));
+		status = stream ? (trace_status_t)open_stream(stream, file_name, &index, cores) : TRACE_ERR_MEMORY;
 	}
+	else
+		status = trace_load(&trace, file_name);
 
+	// open_stream() cleans up after itself, leaving only the stream to free
+	if (status != TRACE_OK)
+		free(stream);
 
-	int job_id = 0;
-	int jobs_ct = 10;
-	simulator_job_list_t* jobs = malloc(jobs_ct * sizeof(simulator_job_list_t));
-
-	char line[1024 + 1];
-	fgets(line, 1024, file);  // Ignore the first (header) line
-	while (fgets(line, 1024, file) != NULL)
+	switch (status)
 	{
-		char *arrival_time = strtok(line, ",");
-		char *run_time = strtok(NULL, ",");
-		char *priority = strtok(NULL, ",");
+		case TRACE_OK:
+			break;
 
-		if (arrival_time != NULL && run_time != NULL && priority != NULL)
-		{
-			if (job_id == jobs_ct)
-			{
-				jobs_ct *= 2;
-				jobs = realloc(jobs, jobs_ct * sizeof(simulator_job_list_t));
+		case TRACE_ERR_OPEN:
+			fprintf(stderr, "Unable to open file \"%s\".\n", file_name);
+			return 2;
 
-				if (!jobs)
-				{
-					fprintf(stderr, "Out of memory.\n");
-					return 2;
-				}
-			}
+		case TRACE_ERR_FORMAT:
+			if (restore_file)
+				fprintf(stderr, "Illegal snapshot file \"%s\": it is damaged or was not written by --checkpoint-file.\n", file_name);
+			else
+				fprintf(stderr, "Illegal file format.\n");
+			return 2;
 
-			jobs[job_id].job_id = job_id;
-			jobs[job_id].arrival_time = atoi(arrival_time);
-			jobs[job_id].run_time = atoi(run_time);
-			jobs[job_id].priority = atoi(priority);
-			jobs[job_id].core_id = -1;
-			jobs[job_id].arrived = 0;
+		default:
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
+	}
 
-			job_id++;
-		}
-		else
+	int job_id = restore_file ? snapshot.num_jobs : 0;
+	int jobs_capacity = restore_file ? job_id + 1 : streaming ? 64 : trace.num_jobs + 1;
+	simulator_job_list_t* jobs = restore_file ? restored_jobs : malloc(jobs_capacity * sizeof(simulator_job_list_t));
+
+	if (!jobs)
+	{
+		fprintf(stderr, "Out of memory.\n");
+		return 2;
+	}
+
+	if (restore_file)
+	{
+		cores = snapshot.cores;
+		if (scheme == -1)
 		{
-			fprintf(stderr, "Illegal file format.\n");
-			return 2;
+			scheme = snapshot.scheme;
+			quantum = snapshot.quantum;
 		}
 	}
+	else if (!streaming)
+	{
+		for (job_id = 0; job_id < trace.num_jobs; job_id++)
+		{
+			jobs[job_id].job_id = job_id;
+			jobs[job_id].arrival_time = trace.jobs[job_id].arrival_time;
+			jobs[job_id].run_time = trace.jobs[job_id].run_time;
+			jobs[job_id].priority = trace.jobs[job_id].priority;
+			jobs[job_id].core_id = -1;
+			jobs[job_id].arrived = 0;
+		}
 
-	fclose(file);
+		trace_free(&trace);
+		build_index(&index, jobs, job_id, cores);
+	}
 
 
 	/*
 	 * Run the simulation.
 	 */
 
-	printf("Loaded %d core(s) and %d job(s) using ", cores, job_id);
-	if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
-	else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
-	else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
-	else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
-	else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
-	else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
-	printf(" scheduling...\n\n");
+	if (verbosity >= VERBOSE_EVENTS && restore_file)
+	{
+		static const char *names[] = { "First Come First Served (FCFS)", "Non-preemptive Shortest Job First (SJF)",
+			"Preemptive Shortest Job First (PSJF)", "Non-preemptive Priority (PRI)", "Preemptive Priority (PPRI)",
+			"Round Robin (RR)", "Multi-level Feedback Queue (MLFQ)", "Completely Fair Scheduler (CFS)" };
+		printf("Restored %d core(s) and %d job(s) at time %d using %s", cores, job_id, snapshot.time, names[scheme]);
+		if (scheme == RR)
+			printf(" with a quantum of %d", quantum);
+		printf(" scheduling...\n\n");
+	}
+	else if (verbosity >= VERBOSE_EVENTS)
+	{
+		if (streaming)
+			printf("Streaming jobs onto %d core(s) using ", cores);
+		else
+			printf("Loaded %d core(s) and %d job(s) using ", cores, job_id);
+		if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
+		else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
+		else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
+		else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
+		else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
+		else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
+		else if (scheme == MLFQ)
+		{
+			printf("Multi-level Feedback Queue (MLFQ) with quanta of");
+			for (int l = 0; l < mlfq_levels; l++)
+				printf("%s%d", l ? "," : " ", mlfq_quanta[l]);
+			if (boost_period > 0)
+				printf(" and a boost every %d", boost_period);
+		}
+		else if (scheme == CFS) { printf("Completely Fair Scheduler (CFS) with a latency of %d and a granularity of %d", cfs_latency, cfs_granularity); }
+		printf(" scheduling...\n\n");
+	}
 
-	scheduler_start_up(cores, scheme);
+	// A restored scheduler keeps its saved configuration, except for the options given again
+	if (!restore_file)
+		scheduler_start_up(cores, scheme);
+	if (scheme == MLFQ && (mlfq_given || !restore_file))
+		scheduler_set_mlfq(mlfq_levels, mlfq_quanta, boost_period);
+	if (scheme == CFS && (cfs_given || !restore_file))
+		scheduler_set_cfs(cfs_latency, cfs_granularity);
+	if (per_core)
+		scheduler_set_per_core_queues(1);
+	if (costs_given || !restore_file)
+		scheduler_set_cost_model(&costs);
 
 
-	int time = 0, i, j;
-	int active_jobs = job_id, jobs_alive = 0;
+	int time = restore_file ? snapshot.time : 0, i, j;
+	int active_jobs = restore_file ? snapshot.active_jobs : job_id, jobs_alive = restore_file ? snapshot.jobs_alive : 0;
+	int events = 0;
 
-	int *quantum_clock = malloc(cores * sizeof(int));
-	char **core_timing_diagram = malloc(cores * sizeof(char *));
-	int core_timing_diagram_size = 1024;
+	int *finished = malloc(cores * sizeof(int));
+	int *arriving = malloc(jobs_capacity * sizeof(int));
+	scheduler_event_t *batch = malloc(jobs_capacity * sizeof(scheduler_event_t));
+	scheduler_decision_t *decisions = malloc(jobs_capacity * sizeof(scheduler_decision_t));
 
-	for (i = 0; i < cores; i++)
+	// A snapshot always carries the diagram, so a restored run can still print it
+	int track_diagram = (verbosity >= VERBOSE_DIAGRAM || dump_file != NULL || checkpoint_file != NULL);
+
+	if (!restore_file)
+	{
+		quantum_clock = malloc(cores * sizeof(int));
+		core_timing_diagram = calloc(cores, sizeof(simulator_diagram_t));
+		for (i = 0; i < cores; i++)
+			quantum_clock[i] = -1;
+	}
+	else if (scheme != snapshot.scheme)
 	{
-		quantum_clock[i] = -1;
-		core_timing_diagram[i] = malloc(core_timing_diagram_size + 1);
-		core_timing_diagram[i][0] = '\0';
+		// A forked variant gives the running jobs a fresh quantum of the new scheme
+		for (i = 0; i < cores; i++)
+			quantum_clock[i] = (scheme == RR) ? quantum : (scheme == MLFQ || scheme == CFS) ? scheduler_quantum(i) : -1;
 	}
 
-	while (active_jobs > 0)
-	{
-		printf("=== [TIME %d] ===\n", time);
+	// The calendar starts out incomplete, so a restored run's busy cores get their entries on the first lookup
+	simulator_calendar_t calendar;
+	if (event_driven)
+		calendar_init(&calendar, cores);
 
+	while (active_jobs > 0 || (stream && stream_peek(stream)))
+	{
 		/*
-		 * 1. Check if any jobs finished in the last time unit.
+		 * 0. Take a snapshot before anything happens in this time unit.
 		 */
-		for (i = 0; i < active_jobs; i++)
+		if (checkpoint_file && ((checkpoint_at >= 0 && time >= checkpoint_at) || (checkpoint_every > 0 && events >= checkpoint_every)))
 		{
-			if (jobs[i].run_time == 0)
+			simulator_snapshot_t state = { time, scheme, quantum, cores, job_id, active_jobs, jobs_alive };
+			if (!save_snapshot(checkpoint_file, &state, jobs, &index, quantum_clock, core_timing_diagram))
 			{
-				// Notify the scheduler has finished
-				int job_id = jobs[i].job_id;
-				int core_id = jobs[i].core_id;
-				int new_job_id = scheduler_job_finished(jobs[i].core_id, jobs[i].job_id, time);
+				fprintf(stderr, "Unable to write file \"%s\".\n", checkpoint_file);
+				return 2;
+			}
 
-				if (scheme == RR)
-					quantum_clock[jobs[i].core_id] = quantum;
+			if (checkpoint_at >= 0 && time >= checkpoint_at)
+				checkpoint_at = -1;
+			events = 0;
+		}
 
-				// Delete the finished jobs, decrease the number of active jobs
-				if (i != active_jobs - 1)
-					memcpy(&jobs[i], &jobs[active_jobs - 1], sizeof(simulator_job_list_t));
-				active_jobs--;
-				jobs_alive--;
-				i--;
+		if (verbosity >= VERBOSE_TICKS)
+			printf("=== [TIME %d] ===\n", time);
 
-				// Set the new job
-				if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
-				{
-					printf("The scheduler_job_finished() selected an invalid job (job_id == %d).\n", new_job_id);
-					print_available_jobs(jobs, active_jobs);
-					return 3;
-				}
-				else
-				{
-					printf("Job %d, running on core %d, finished. Core %d is now running job %d.\n", job_id, core_id, core_id, new_job_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-				}
+		/*
+		 * 1. Check if any jobs finished in the last time unit.
+		 *
+		 * Only running jobs can finish.  They are handled in the order handled_before()
+		 * gives, which in loaded mode changes as finished jobs are swapped out, so pick
+		 * the first one each round.
+		 */
+		int finished_ct = 0;
+		for (i = 0; i < cores; i++)
+			if (index.core_job[i] != -1 && jobs[job_slot(&index, index.core_job[i])].run_time == 0)
+				finished[finished_ct++] = index.core_job[i];
+
+		while (finished_ct > 0)
+		{
+			int first = 0;
+			for (j = 1; j < finished_ct; j++)
+				if (handled_before(jobs, &index, finished[j], finished[first]))
+					first = j;
+
+			i = job_slot(&index, finished[first]);
+			finished[first] = finished[--finished_ct];
+
+			// Notify the scheduler has finished
+			int job_id = jobs[i].job_id;
+			int core_id = jobs[i].core_id;
+			int new_job_id = scheduler_job_finished(jobs[i].core_id, jobs[i].job_id, time);
+			events++;
+
+			if (scheme == RR)
+				quantum_clock[jobs[i].core_id] = quantum;
+			else if (scheme == MLFQ || scheme == CFS)
+				quantum_clock[core_id] = scheduler_quantum(core_id);
+
+			// Delete the finished jobs, decrease the number of active jobs
+			index.core_job[core_id] = -1;
+			if (event_driven)
+				calendar_touch(&calendar, core_id);
+			remove_job(i, jobs, &index, &active_jobs);
+			jobs_alive--;
+
+			// Set the new job
+			if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, &index) )
+			{
+				printf("The scheduler_job_finished() selected an invalid job (job_id == %d).\n", new_job_id);
+				print_available_jobs(jobs, active_jobs);
+				return 3;
+			}
+			// The job pays for the dispatch before its time slice starts
+			if (new_job_id != -1)
+			{
+				int cost = scheduler_dispatch_cost(core_id);
+				jobs[job_slot(&index, new_job_id)].run_time += cost;
+				quantum_clock[core_id] += cost;
+			}
+
+			if (verbosity >= VERBOSE_EVENTS)
+			{
+				printf("Job %d, running on core %d, finished. Core %d is now running job %d.\n", job_id, core_id, core_id, new_job_id);
+				printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
 			}
 		}
 
 		/*
 		 * Check to see if we finished our last job.  (If we don't check here, we would run an extra time unit that will be totally idle.)
 		 */
-		if (active_jobs == 0)
+		if (active_jobs == 0 && !(stream && stream_peek(stream)))
 			break;
 
 		/*
 		 * 2. Check of any quantums expired in the last time unit.
 		 */
-		if (scheme == RR)
+		if (scheme == RR || scheme == MLFQ || scheme == CFS)
 		{
 			for (i = 0; i < cores; i++)
 			{
-				if (quantum_clock[i] == 0)
+				if (quantum_clock[i] == 0 && index.core_job[i] != -1)
 				{
-					for (j = 0; j < active_jobs; j++)
+					// Notify the scheduler the quantum has expired
+					j = job_slot(&index, index.core_job[i]);
+					int core_id = i;
+					int old_job_id = jobs[j].job_id;
+					int new_job_id = scheduler_quantum_expired(core_id, time);
+					events++;
+
+					jobs[j].core_id = -1;
+					index.core_job[core_id] = -1;
+					if (event_driven)
+						calendar_touch(&calendar, core_id);
+
+					quantum_clock[core_id] = (scheme == RR) ? quantum : scheduler_quantum(core_id);
+
+					// Set the new job
+					if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, &index) )
+					{
+						printf("The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", new_job_id);
+						print_available_jobs(jobs, active_jobs);
+						return 3;
+					}
+					if (new_job_id != -1)
 					{
-						if (jobs[j].core_id == i)
-						{
-							// Notify the scheduler the quantum has expired
-							int core_id = jobs[j].core_id;
-							int old_job_id = jobs[j].job_id;
-							int new_job_id = scheduler_quantum_expired(jobs[j].core_id, time);
-
-							jobs[j].core_id = -1;
-
-							quantum_clock[core_id] = quantum;
-
-							// Set the new job
-							if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
-							{
-								printf("The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", new_job_id);
-								print_available_jobs(jobs, active_jobs);
-								return 3;
-							}
-							else
-							{
-								printf("Job %d, running on core %d, had its quantum expire. Core %d is now running job %d.\n", old_job_id, core_id, core_id, new_job_id);
-								printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-							}
-
-							break;
-						}
+						int cost = scheduler_dispatch_cost(core_id);
+						jobs[job_slot(&index, new_job_id)].run_time += cost;
+						quantum_clock[core_id] += cost;
+					}
+
+					if (verbosity >= VERBOSE_EVENTS)
+					{
+						printf("Job %d, running on core %d, had its quantum expire. Core %d is now running job %d.\n", old_job_id, core_id, core_id, new_job_id);
+						printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
 					}
 				}
 			}
@@ -330,119 +1441,146 @@ int main(int argc, char **argv)
 
 		/*
 		 * 3. Check for any new jobs that arrive in this time unit
+		 *
+		 * Jobs arriving together are handled in handled_before() order, like the
+		 * finished ones, and handed to the scheduler as one batch.
 		 */
-		for (i = 0; i < active_jobs; i++)
+		int arriving_ct = 0;
+		trace_job_t *pending;
+		while (stream && (pending = stream_peek(stream)) != NULL && pending->arrival_time <= time)
 		{
-			if (jobs[i].arrival_time == time)
+			stream->next++;
+
+			if (active_jobs == jobs_capacity)
 			{
-				int new_job_core_id = scheduler_new_job(jobs[i].job_id, time, jobs[i].run_time, jobs[i].priority);
-				jobs[i].arrived = 1;
-				jobs_alive++;
+				jobs_capacity *= 2;
+				jobs = realloc(jobs, jobs_capacity * sizeof(simulator_job_list_t));
+				arriving = realloc(arriving, jobs_capacity * sizeof(int));
+				batch = realloc(batch, jobs_capacity * sizeof(scheduler_event_t));
+				decisions = realloc(decisions, jobs_capacity * sizeof(scheduler_decision_t));
+			}
 
-				if (new_job_core_id >= 0 && new_job_core_id < cores)
+			i = active_jobs++;
+			jobs[i].job_id = index.num_jobs++;
+			jobs[i].arrival_time = pending->arrival_time;
+			jobs[i].run_time = pending->run_time;
+			jobs[i].priority = pending->priority;
+			jobs[i].core_id = -1;
+			jobs[i].arrived = 0;
+			set_job_slot(&index, jobs[i].job_id, i);
+			arriving[arriving_ct++] = jobs[i].job_id;  // Appended in trace order, already handled_before() order
+		}
+
+		while (!stream && index.next_arrival < job_id &&
+				jobs[job_slot(&index, index.arrival_order[index.next_arrival])].arrival_time <= time)
+		{
+			int arriving_id = index.arrival_order[index.next_arrival++];
+			for (j = arriving_ct++; j > 0 && handled_before(jobs, &index, arriving_id, arriving[j - 1]); j--)
+				arriving[j] = arriving[j - 1];
+			arriving[j] = arriving_id;
+		}
+
+		for (int a = 0; a < arriving_ct; a++)
+		{
+			i = job_slot(&index, arriving[a]);
+			batch[a] = (scheduler_event_t) { SCHEDULER_NEW_JOB, -1, jobs[i].job_id, jobs[i].run_time, jobs[i].priority };
+		}
+		if (arriving_ct > 0)
+			scheduler_submit_batch(time, batch, arriving_ct, decisions);
+		events += arriving_ct;
+
+		for (int a = 0; a < arriving_ct; a++)
+		{
+			i = job_slot(&index, arriving[a]);
+			int new_job_core_id = decisions[a].core_id;
+			jobs[i].arrived = 1;
+			jobs_alive++;
+
+			if (new_job_core_id >= 0 && new_job_core_id < cores)
+			{
+				if (verbosity >= VERBOSE_EVENTS)
 				{
 					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is now running on core %d.\n",
 							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id, new_job_core_id);
 					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
+				}
 
-					// Find if anyone is currently using the core.
-					for (j = 0; j < active_jobs; j++)
-						if (jobs[j].core_id == new_job_core_id)
-							jobs[j].core_id = -1;
+				// Find if anyone is currently using the core.
+				if (index.core_job[new_job_core_id] != -1)
+					jobs[job_slot(&index, index.core_job[new_job_core_id])].core_id = -1;
 
-					// Assign the core to the new job
-					jobs[i].core_id = new_job_core_id;
+				// Assign the core to the new job
+				jobs[i].core_id = new_job_core_id;
+				index.core_job[new_job_core_id] = jobs[i].job_id;
+				if (event_driven)
+					calendar_touch(&calendar, new_job_core_id);
 
-					if (scheme == RR)
-						quantum_clock[new_job_core_id] = quantum;
-				}
-				else if (new_job_core_id == -1)
+				if (scheme == RR)
+					quantum_clock[new_job_core_id] = quantum;
+				else if (scheme == MLFQ || scheme == CFS)
+					quantum_clock[new_job_core_id] = decisions[a].quantum;
+			}
+			else if (new_job_core_id == -1)
+			{
+				if (verbosity >= VERBOSE_EVENTS)
 				{
 					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is set to idle (-1).\n",
 							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id);
 					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
 				}
-				else
-				{
-					printf("The scheduler_new_job() selected an invalid core (core_id == %d).\n", new_job_core_id);
-					print_available_cores(cores);
-					return 3;
-				}
+			}
+			else
+			{
+				printf("The scheduler_submit_batch() selected an invalid core (core_id == %d).\n", new_job_core_id);
+				print_available_cores(cores);
+				return 3;
 			}
 		}
 
 
 		/*
-		 * 4. Run the time unit.
+		 * 4. Run the time unit.  In event-driven mode, run every time unit up to the next event at once.
 		 */
-		char time_string[cores][11];
-		int cores_working = 0;
+		int ticks = 1;
+		if (event_driven)
+			ticks = ticks_until_next_event(time, jobs, &index, cores, quantum_clock, scheme, &calendar);
 
-		for (i = 0; i < cores; i++)
-			time_string[i][0] = '\0';
+		int cores_working = 0;
 
-		for (i = 0; i < active_jobs; i++)
+		for (j = 0; j < cores; j++)
 		{
-			if (jobs[i].core_id != -1)
+			if (index.core_job[j] != -1)
 			{
+				i = job_slot(&index, index.core_job[j]);
 				cores_working++;
-				jobs[i].run_time--;
-				quantum_clock[jobs[i].core_id]--;
-
-				assert(time_string[jobs[i].core_id][0] == '\0');
-
-				if (jobs[i].job_id < 10)
-					sprintf(time_string[jobs[i].core_id], "%d", jobs[i].job_id);
-				else if (jobs[i].job_id < 10 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 + 'a');
-				else if (jobs[i].job_id < 10 + 26 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 - 26 + 'A');
-				else
-					snprintf(time_string[jobs[i].core_id], 10, "(%d)", jobs[i].job_id);
-			}
-		}
-
-		for (i = 0; i < cores; i++)
-		{
-			// If the core is idle, print a '-'
-			if (time_string[i][0] == '\0')
-				strcpy(time_string[i], "-");
+				jobs[i].run_time -= ticks;
+				quantum_clock[jobs[i].core_id] -= ticks;
 
-			// Ensure we have enough memory
-			while (strlen(core_timing_diagram[i]) + strlen(time_string[i]) >= (unsigned int)core_timing_diagram_size)
-			{
-				core_timing_diagram_size *= 2;
-
-				for (j = 0; j < cores; j++)
-				{
-					core_timing_diagram[j] = realloc(core_timing_diagram[j], core_timing_diagram_size + 1);
-
-					if (core_timing_diagram[j] == NULL)
-					{
-						fprintf(stderr, "Out of memory.\n");
-						return 3;
-					}
-				}
+				assert(jobs[i].core_id == j);
 			}
 
-			strcat( core_timing_diagram[i], time_string[i] );
+			if (track_diagram)
+				diagram_append(&core_timing_diagram[j], index.core_job[j], time, ticks);
 		}
 
 
 		/*
 		 * 5. Print data!
 		 */
-		printf("At the end of time unit %d...\n", time);
+		if (verbosity >= VERBOSE_TICKS)
+		{
+			printf("At the end of time unit %d...\n", time + ticks - 1);
 
-		for (i = 0; i < cores; i++)
-			printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
+			for (i = 0; i < cores; i++)
+				print_diagram(i, &core_timing_diagram[i]);
 
-		printf("\n");
+			printf("\n");
 
-		printf("  Queue: ");
-		scheduler_show_queue();
-		printf("\n");
-		printf("\n");
+			printf("  Queue: ");
+			scheduler_show_queue();
+			printf("\n");
+			printf("\n");
+		}
 
 
 		/*
@@ -461,27 +1599,71 @@ int main(int argc, char **argv)
 		/*
 		 * 7. Increase time
 		 */
-		time++;
+		time += ticks;
 	}
 
+	int exit_code = 0;
+	if (stream && (stream->unsorted || stream->reader.status != TRACE_OK))
+	{
+		fprintf(stderr, stream->unsorted ? "Streaming mode (-l) requires a trace sorted by arrival time.\n" : "Illegal file format.\n");
+		exit_code = 2;
+		goto clean_up;
+	}
 
-	printf("FINAL TIMING DIAGRAM:\n");
-	for (i = 0; i < cores; i++)
-		printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
+	if (checkpoint_at >= 0)
+		fprintf(stderr, "The simulation ended before time %d, so no snapshot was written.\n", checkpoint_at);
 
-	printf("\n");
+	if (verbosity >= VERBOSE_DIAGRAM)
+	{
+		printf("FINAL TIMING DIAGRAM:\n");
+		for (i = 0; i < cores; i++)
+			print_diagram(i, &core_timing_diagram[i]);
+
+		printf("\n");
+	}
 	printf("Average Waiting Time: %.2f\n", scheduler_average_waiting_time());
 	printf("Average Turnaround Time: %.2f\n", scheduler_average_turnaround_time());
 	printf("Average Response Time: %.2f\n", scheduler_average_response_time());
+	if (show_counters)
+	{
+		scheduler_counters_t counters;
+		scheduler_counters(&counters);
+		printf("Makespan: %d\n", time);
+		printf("Steals: %lld\n", counters.steals);
+		printf("Migrations: %lld\n", counters.migrations);
+		printf("Queue Operations: %lld\n", counters.queue_ops);
+		printf("Overhead: %lld (%lld switches, %lld socket and %lld NUMA migrations charged)\n",
+				counters.overhead, counters.switches, counters.socket_migrations, counters.numa_migrations);
+	}
+	if (show_percentiles)
+		print_percentiles();
+	if (show_stats)
+		scheduler_dump_stats();
 
+clean_up:
 	scheduler_clean_up();
 
 
+	if (event_driven)
+		calendar_free(&calendar);
 	free(quantum_clock);
+	free(finished);
+	free(arriving);
+	free(batch);
+	free(decisions);
+	free_index(&index);
+	if (stream)
+	{
+		close_stream(stream);
+		free(stream);
+	}
+	if (exit_code == 0 && dump_file != NULL && !dump_diagrams(dump_file, core_timing_diagram, cores))
+		exit_code = 2;
+
 	for (i=0; i < cores; i++)
-		free(core_timing_diagram[i]);
+		free(core_timing_diagram[i].segments);
 	free(core_timing_diagram);
 	free(jobs);
 
-	return 0;
+	return exit_code;
 }
@@ -0,0 +1,637 @@
+/** @file sweep.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libscheduler/libscheduler.h"
+#include "libtrace/libtrace.h"
+
+
+/*
+ * Runs one trace through a grid of schemes and core counts on a pool of
+ * threads, each simulation on its own scheduler_ctx_t, and prints the three
+ * averages of every configuration as one CSV or JSON table.
+ *
+ * The simulation matches "simulator -e" with the trace loaded: events that
+ * fall on the same time unit are handled in the same order, so the averages
+ * agree with its output.  make check compares the two (sweepcheck.pl).
+ */
+
+typedef struct _sweep_config_t
+{
+	int cores;
+	scheme_t scheme;
+	int quantum;
+	int failed;
+	float waiting, turnaround, response;
+} sweep_config_t;
+
+typedef struct _sweep_t
+{
+	const trace_t *trace;
+	const int *arrival_order;  // job_ids sorted by arrival time, shared by every run
+	sweep_config_t *configs;
+	int num_configs;
+	int next_config;
+	pthread_mutex_t lock;
+} sweep_t;
+
+typedef struct _sweep_job_t
+{
+	int job_id, run_time, core_id, arrived;
+} sweep_job_t;
+
+/*
+ * Per-run state, laid out like the simulator's: a jobs array compacted by
+ * moving the last job into a finished job's slot, and the lookups into it.
+ */
+typedef struct _sweep_run_t
+{
+	sweep_job_t *jobs;
+	int active_jobs;
+	int *slot_of;
+	int *core_job;
+	int *quantum_clock;
+	int *pending;
+	scheduler_event_t *batch;
+	scheduler_decision_t *decisions;
+} sweep_run_t;
+
+static const char *scheme_names[] = { "fcfs", "sjf", "psjf", "pri", "ppri", "rr", "mlfq", "cfs" };
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-c <cores>] [-s <schemes>] [-t <threads>] [-j] [-o <file>] <input file>\n", program_name);
+	fprintf(stderr, "       %s -c 1-4,8,16 -s fcfs,sjf,rr2,rr4 examples/proc1.csv\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -c  comma separated core counts or ranges (default 1,2,4,8)\n");
+	fprintf(stderr, "  -s  comma separated schemes: fcfs, sjf, psjf, pri, ppri, rr#, mlfq, cfs (default all, with rr1,rr2,rr4)\n");
+	fprintf(stderr, "  -t  worker threads (default: one per online CPU)\n");
+	fprintf(stderr, "  -j  write JSON instead of CSV\n");
+	fprintf(stderr, "  -o  write the table to <file> instead of stdout\n");
+}
+
+/*
+ * Parses "1-4,8" into a newly allocated list of core counts.  Returns the
+ * number of entries, or -1, with nothing left allocated, when the list is
+ * malformed or empty.
+ */
+int parse_cores(const char *list, int **cores)
+{
+	int count = 0, capacity = 16;
+	const char *p = list;
+	*cores = malloc(capacity * sizeof(int));
+
+	while (*p)
+	{
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p || first <= 0)
+		{
+			free(*cores);
+			return -1;
+		}
+
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+			{
+				free(*cores);
+				return -1;
+			}
+		}
+
+		for (; first <= last; first++)
+		{
+			if (count == capacity)
+			{
+				capacity *= 2;
+				*cores = realloc(*cores, capacity * sizeof(int));
+			}
+			(*cores)[count++] = (int)first;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+		{
+			free(*cores);
+			return -1;
+		}
+		p = end;
+	}
+
+	if (count == 0)
+	{
+		free(*cores);
+		return -1;
+	}
+	return count;
+}
+
+/*
+ * Parses one scheme name the way the simulator's -s does.  Returns 0 when the
+ * name is not a scheme.
+ */
+int parse_scheme(const char *name, int length, scheme_t *scheme, int *quantum)
+{
+	int i;
+	*quantum = 0;
+
+	for (i = FCFS; i <= PPRI; i++)
+	{
+		if ((int)strlen(scheme_names[i]) == length && strncasecmp(name, scheme_names[i], length) == 0)
+		{
+			*scheme = i;
+			return 1;
+		}
+	}
+
+	if (length == 4 && strncasecmp(name, "mlfq", 4) == 0)
+	{
+		*scheme = MLFQ;
+		return 1;
+	}
+
+	if (length == 3 && strncasecmp(name, "cfs", 3) == 0)
+	{
+		*scheme = CFS;
+		return 1;
+	}
+
+	if (length > 2 && strncasecmp(name, "rr", 2) == 0)
+	{
+		*scheme = RR;
+		*quantum = atoi(name + 2);
+		return *quantum > 0;
+	}
+
+	return 0;
+}
+
+/*
+ * The quantum a core's new job gets: RR's fixed one, or whatever the MLFQ
+ * level or CFS slice of the job the scheduler just put there calls for.
+ */
+int quantum_for(scheduler_ctx_t *ctx, const sweep_config_t *config, int core_id)
+{
+	return (config->scheme == RR) ? config->quantum : scheduler_ctx_quantum(ctx, core_id);
+}
+
+typedef struct _sweep_arrival_t
+{
+	int arrival_time, job_id;
+} sweep_arrival_t;
+
+int compare_arrivals(const void *a, const void *b)
+{
+	const sweep_arrival_t *x = a, *y = b;
+	if (x->arrival_time != y->arrival_time)
+		return (x->arrival_time < y->arrival_time) ? -1 : 1;
+	return x->job_id - y->job_id;
+}
+
+void remove_job(sweep_run_t *run, int slot)
+{
+	run->slot_of[run->jobs[slot].job_id] = -1;
+	run->active_jobs--;
+
+	if (slot != run->active_jobs)
+	{
+		run->jobs[slot] = run->jobs[run->active_jobs];
+		run->slot_of[run->jobs[slot].job_id] = slot;
+	}
+}
+
+// Puts job_id on core_id, returning 0 when it is not a job that can run
+int set_active_job(sweep_run_t *run, int num_jobs, int job_id, int core_id)
+{
+	if (job_id < 0 || job_id >= num_jobs || run->slot_of[job_id] == -1)
+		return 0;
+
+	sweep_job_t *job = &run->jobs[run->slot_of[job_id]];
+	if (!job->arrived)
+		return 0;
+
+	if (job->core_id != -1 && run->core_job[job->core_id] == job_id)
+		run->core_job[job->core_id] = -1;
+
+	job->core_id = core_id;
+	run->core_job[core_id] = job_id;
+	return 1;
+}
+
+/*
+ * Simulates one configuration, filling in its averages.  Returns 0 if the
+ * scheduler made an invalid decision.
+ */
+int run_config(const sweep_t *sweep, sweep_config_t *config, sweep_run_t *run)
+{
+	const trace_t *trace = sweep->trace;
+	int num_jobs = trace->num_jobs, cores = config->cores;
+	int time = 0, next_arrival = 0, jobs_alive = 0, ok = 1;
+	int i, j;
+
+	for (i = 0; i < num_jobs; i++)
+	{
+		run->jobs[i].job_id = i;
+		run->jobs[i].run_time = trace->jobs[i].run_time;
+		run->jobs[i].core_id = -1;
+		run->jobs[i].arrived = 0;
+		run->slot_of[i] = i;
+	}
+	run->active_jobs = num_jobs;
+
+	for (i = 0; i < cores; i++)
+	{
+		run->core_job[i] = -1;
+		run->quantum_clock[i] = -1;
+	}
+
+	scheduler_ctx_t *ctx = scheduler_ctx_create(cores, config->scheme);
+
+	while (ok && run->active_jobs > 0)
+	{
+		// Jobs that finished, lowest slot first
+		int pending_ct = 0;
+		for (i = 0; i < cores; i++)
+			if (run->core_job[i] != -1 && run->jobs[run->slot_of[run->core_job[i]]].run_time == 0)
+				run->pending[pending_ct++] = run->core_job[i];
+
+		while (ok && pending_ct > 0)
+		{
+			int first = 0;
+			for (j = 1; j < pending_ct; j++)
+				if (run->slot_of[run->pending[j]] < run->slot_of[run->pending[first]])
+					first = j;
+
+			int slot = run->slot_of[run->pending[first]];
+			run->pending[first] = run->pending[--pending_ct];
+
+			int core_id = run->jobs[slot].core_id;
+			int new_job_id = scheduler_ctx_job_finished(ctx, core_id, run->jobs[slot].job_id, time);
+
+			if (config->scheme == RR || config->scheme == MLFQ || config->scheme == CFS)
+				run->quantum_clock[core_id] = quantum_for(ctx, config, core_id);
+
+			run->core_job[core_id] = -1;
+			remove_job(run, slot);
+			jobs_alive--;
+
+			if (new_job_id != -1 && !set_active_job(run, num_jobs, new_job_id, core_id))
+				ok = 0;
+		}
+
+		if (!ok || run->active_jobs == 0)
+			break;
+
+		// Quantums that expired, in core order
+		if (config->scheme == RR || config->scheme == MLFQ || config->scheme == CFS)
+		{
+			for (i = 0; ok && i < cores; i++)
+			{
+				if (run->quantum_clock[i] == 0 && run->core_job[i] != -1)
+				{
+					run->jobs[run->slot_of[run->core_job[i]]].core_id = -1;
+					run->core_job[i] = -1;
+
+					int new_job_id = scheduler_ctx_quantum_expired(ctx, i, time);
+					run->quantum_clock[i] = quantum_for(ctx, config, i);
+					if (new_job_id != -1 && !set_active_job(run, num_jobs, new_job_id, i))
+						ok = 0;
+				}
+			}
+		}
+
+		// Jobs that arrive now, lowest slot first
+		pending_ct = 0;
+		while (next_arrival < num_jobs && trace->jobs[sweep->arrival_order[next_arrival]].arrival_time <= time)
+		{
+			int arriving_id = sweep->arrival_order[next_arrival++];
+			for (j = pending_ct++; j > 0 && run->slot_of[run->pending[j - 1]] > run->slot_of[arriving_id]; j--)
+				run->pending[j] = run->pending[j - 1];
+			run->pending[j] = arriving_id;
+		}
+
+		// Everything arriving now goes to the scheduler as one batch
+		for (j = 0; j < pending_ct; j++)
+		{
+			const trace_job_t *info = &trace->jobs[run->pending[j]];
+			run->batch[j] = (scheduler_event_t) { SCHEDULER_NEW_JOB, -1, run->pending[j], info->run_time, info->priority };
+		}
+		if (pending_ct > 0)
+			scheduler_ctx_submit_batch(ctx, time, run->batch, pending_ct, run->decisions);
+
+		for (j = 0; ok && j < pending_ct; j++)
+		{
+			sweep_job_t *job = &run->jobs[run->slot_of[run->pending[j]]];
+			int core_id = run->decisions[j].core_id;
+			job->arrived = 1;
+			jobs_alive++;
+
+			if (core_id >= 0 && core_id < cores)
+			{
+				if (run->core_job[core_id] != -1)
+					run->jobs[run->slot_of[run->core_job[core_id]]].core_id = -1;
+
+				job->core_id = core_id;
+				run->core_job[core_id] = job->job_id;
+
+				if (config->scheme == RR)
+					run->quantum_clock[core_id] = config->quantum;
+				else if (config->scheme == MLFQ || config->scheme == CFS)
+					run->quantum_clock[core_id] = run->decisions[j].quantum;
+			}
+			else if (core_id != -1)
+				ok = 0;
+		}
+
+		if (!ok)
+			break;
+
+		// Run up to the next arrival, completion or quantum expiry
+		int next = -1, cores_working = 0;
+		if (next_arrival < num_jobs)
+			next = trace->jobs[sweep->arrival_order[next_arrival]].arrival_time;
+
+		for (i = 0; i < cores; i++)
+		{
+			if (run->core_job[i] != -1)
+			{
+				int event = time + run->jobs[run->slot_of[run->core_job[i]]].run_time;
+				if ((config->scheme == RR || config->scheme == MLFQ || config->scheme == CFS) && time + run->quantum_clock[i] < event)
+					event = time + run->quantum_clock[i];
+
+				if (next == -1 || event < next)
+					next = event;
+			}
+		}
+
+		int ticks = (next > time) ? next - time : 1;
+		for (i = 0; i < cores; i++)
+		{
+			if (run->core_job[i] != -1)
+			{
+				cores_working++;
+				run->jobs[run->slot_of[run->core_job[i]]].run_time -= ticks;
+				run->quantum_clock[i] -= ticks;
+			}
+		}
+
+		// A job is waiting but the scheduler left every core idle
+		if (jobs_alive > 0 && cores_working == 0)
+			ok = 0;
+
+		time += ticks;
+	}
+
+	config->failed = !ok;
+	config->waiting = scheduler_ctx_average_waiting_time(ctx);
+	config->turnaround = scheduler_ctx_average_turnaround_time(ctx);
+	config->response = scheduler_ctx_average_response_time(ctx);
+	scheduler_ctx_destroy(ctx);
+
+	return ok;
+}
+
+void *sweep_worker(void *arg)
+{
+	sweep_t *sweep = arg;
+	int num_jobs = sweep->trace->num_jobs, max_cores = 0, i;
+	sweep_run_t run;
+
+	for (i = 0; i < sweep->num_configs; i++)
+		if (sweep->configs[i].cores > max_cores)
+			max_cores = sweep->configs[i].cores;
+
+	// Sized once for the largest configuration and reused by every run
+	run.jobs = malloc((num_jobs + 1) * sizeof(sweep_job_t));
+	run.slot_of = malloc((num_jobs + 1) * sizeof(int));
+	run.pending = malloc((num_jobs + max_cores + 1) * sizeof(int));
+	run.batch = malloc((num_jobs + 1) * sizeof(scheduler_event_t));
+	run.decisions = malloc((num_jobs + 1) * sizeof(scheduler_decision_t));
+	run.core_job = malloc(max_cores * sizeof(int));
+	run.quantum_clock = malloc(max_cores * sizeof(int));
+
+	for (;;)
+	{
+		pthread_mutex_lock(&sweep->lock);
+		int next = sweep->next_config++;
+		pthread_mutex_unlock(&sweep->lock);
+
+		if (next >= sweep->num_configs)
+			break;
+		run_config(sweep, &sweep->configs[next], &run);
+	}
+
+	free(run.jobs);
+	free(run.slot_of);
+	free(run.pending);
+	free(run.batch);
+	free(run.decisions);
+	free(run.core_job);
+	free(run.quantum_clock);
+	return NULL;
+}
+
+void write_table(FILE *out, const sweep_config_t *configs, int num_configs, int json)
+{
+	int i;
+
+	if (json)
+		fprintf(out, "[\n");
+	else
+		fprintf(out, "\"Scheme\",\"Cores\",\"Average Waiting Time\",\"Average Turnaround Time\",\"Average Response Time\"\n");
+
+	for (i = 0; i < num_configs; i++)
+	{
+		const sweep_config_t *c = &configs[i];
+		char name[16];
+		if (c->scheme == RR)
+			snprintf(name, sizeof(name), "rr%d", c->quantum);
+		else
+			snprintf(name, sizeof(name), "%s", scheme_names[c->scheme]);
+
+		if (json)
+		{
+			if (c->failed)
+				fprintf(out, "  {\"scheme\": \"%s\", \"cores\": %d, \"error\": \"invalid scheduling decision\"}", name, c->cores);
+			else
+				fprintf(out, "  {\"scheme\": \"%s\", \"cores\": %d, \"waiting\": %.2f, \"turnaround\": %.2f, \"response\": %.2f}",
+						name, c->cores, c->waiting, c->turnaround, c->response);
+			fprintf(out, (i + 1 < num_configs) ? ",\n" : "\n");
+		}
+		else if (c->failed)
+			fprintf(out, "%s,%d,error,error,error\n", name, c->cores);
+		else
+			fprintf(out, "%s,%d,%.2f,%.2f,%.2f\n", name, c->cores, c->waiting, c->turnaround, c->response);
+	}
+
+	if (json)
+		fprintf(out, "]\n");
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, j;
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), json = 0;
+	char *core_list = "1,2,4,8", *scheme_list = "fcfs,sjf,psjf,pri,ppri,rr1,rr2,rr4";
+	char *out_file = NULL;
+
+	while ((c = getopt(argc, argv, "c:s:t:jo:")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				core_list = optarg;
+				break;
+
+			case 's':
+				scheme_list = optarg;
+				break;
+
+			case 't':
+				threads = atoi(optarg);
+
+				if (threads <= 0)
+				{
+					fprintf(stderr, "Option -t <threads> requires a positive number.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'j':
+				json = 1;
+				break;
+
+			case 'o':
+				out_file = optarg;
+				break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "A single input file is required.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	int *cores, num_cores = parse_cores(core_list, &cores);
+	if (num_cores <= 0)
+	{
+		fprintf(stderr, "Option -c <cores> requires positive numbers or ranges. (Eg: -c 1-4,8)\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	// Every scheme crossed with every core count, schemes varying slowest
+	int num_schemes = 1;
+	for (i = 0; scheme_list[i]; i++)
+		num_schemes += (scheme_list[i] == ',');
+
+	sweep_config_t *configs = calloc((size_t)num_schemes * num_cores, sizeof(sweep_config_t));
+	int num_configs = 0;
+	const char *name = scheme_list;
+
+	for (i = 0; i < num_schemes; i++)
+	{
+		const char *end = strchr(name, ',');
+		int length = end ? (int)(end - name) : (int)strlen(name);
+		scheme_t scheme;
+		int quantum;
+
+		if (!parse_scheme(name, length, &scheme, &quantum))
+		{
+			fprintf(stderr, "Unknown scheme \"%.*s\".\n", length, name);
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		for (j = 0; j < num_cores; j++)
+		{
+			configs[num_configs].cores = cores[j];
+			configs[num_configs].scheme = scheme;
+			configs[num_configs].quantum = quantum;
+			num_configs++;
+		}
+		name += length + 1;
+	}
+	free(cores);
+
+	trace_t trace;
+	switch (trace_load(&trace, argv[optind]))
+	{
+		case TRACE_OK:
+			break;
+
+		case TRACE_ERR_OPEN:
+			fprintf(stderr, "Unable to open file \"%s\".\n", argv[optind]);
+			return 2;
+
+		case TRACE_ERR_FORMAT:
+			fprintf(stderr, "Illegal file format.\n");
+			return 2;
+
+		default:
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
+	}
+
+	int *arrival_order = malloc((trace.num_jobs + 1) * sizeof(int));
+	sweep_arrival_t *arrivals = malloc((trace.num_jobs + 1) * sizeof(sweep_arrival_t));
+	for (i = 0; i < trace.num_jobs; i++)
+	{
+		arrivals[i].arrival_time = trace.jobs[i].arrival_time;
+		arrivals[i].job_id = i;
+	}
+
+	qsort(arrivals, trace.num_jobs, sizeof(sweep_arrival_t), compare_arrivals);
+	for (i = 0; i < trace.num_jobs; i++)
+		arrival_order[i] = arrivals[i].job_id;
+	free(arrivals);
+
+	sweep_t sweep = { &trace, arrival_order, configs, num_configs, 0, PTHREAD_MUTEX_INITIALIZER };
+
+	if (threads > num_configs)
+		threads = num_configs;
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	for (i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, sweep_worker, &sweep);
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	FILE *out = out_file ? fopen(out_file, "w") : stdout;
+	if (!out)
+	{
+		fprintf(stderr, "Unable to write file \"%s\".\n", out_file);
+		return 2;
+	}
+	write_table(out, configs, num_configs, json);
+	if (out != stdout)
+		fclose(out);
+
+	int failed = 0;
+	for (i = 0; i < num_configs; i++)
+		failed += configs[i].failed;
+	if (failed)
+		fprintf(stderr, "%d configuration(s) stopped on an invalid scheduling decision.\n", failed);
+
+	free(workers);
+	free(arrival_order);
+	free(configs);
+	trace_free(&trace);
+
+	return failed ? 3 : 0;
+}
@@ -0,0 +1,28 @@
+#!/usr/bin/perl
+
+# EECS678
+
+# Runs sweep over every example trace and checks each row of its table
+# against the averages the simulator prints for the same scheme and cores.
+@schemes = qw(fcfs sjf psjf pri ppri rr1 rr2 rr4 mlfq cfs);
+@cores = (1, 2, 3, 4, 8);
+
+for $trace (<examples/proc*.csv>){
+	@rows = `./sweep -t 2 -c @{[join(",", @cores)]} -s @{[join(",", @schemes)]} $trace`;
+	if($?){
+		print "sweep failed on $trace\n";
+		$failed = 1;
+		next;
+	}
+	shift @rows;
+	for $row (@rows){
+		chomp $row;
+		($scheme, $core, @sweep) = split(/,/, $row);
+		@simulator = map { /: (\S+)$/ ? $1 : () } `./simulator -e -q -c $core -s $scheme $trace | tail -3`;
+		if("@sweep" ne "@simulator"){
+			print "sweep differs from simulator -e on $trace -c $core -s $scheme: @sweep vs @simulator\n";
+			$failed = 1;
+		}
+	}
+}
+exit($failed ? 1 : 0);
@@ -0,0 +1,275 @@
+/** @file tracegen.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "libtrace/libtrace.h"
+
+
+/*
+ * Generates synthetic traces for exercising the scheduler at scale.
+ *
+ * Arrivals are either a Poisson process or bursts: groups of jobs (of
+ * geometric size) arriving ten times faster than the mean, separated by
+ * idle gaps long enough to keep the overall mean inter-arrival time.
+ * Run times are exponential, Pareto (heavy tailed) or uniform around the
+ * requested mean, and priorities uniform, Zipf (skewed towards 0) or
+ * constant over [0, levels). Arrival times never decrease, so the output
+ * also works with simulator -l.
+ */
+
+typedef enum { ARRIVE_POISSON = 0, ARRIVE_BURSTY } arrival_model_t;
+typedef enum { RUN_EXPONENTIAL = 0, RUN_PARETO, RUN_UNIFORM } run_model_t;
+typedef enum { PRIORITY_UNIFORM = 0, PRIORITY_ZIPF, PRIORITY_CONSTANT } priority_model_t;
+
+typedef struct _tracegen_t
+{
+	arrival_model_t arrivals;
+	double mean_gap;       // mean time between arrivals
+	double burst_length;   // mean jobs per burst
+	run_model_t runs;
+	double mean_run;
+	double alpha;          // Pareto shape, larger is lighter tailed
+	priority_model_t priorities;
+	int levels;
+	double *zipf;          // cumulative Zipf weights, one per level
+	uint64_t rng;
+
+	double clock;
+	int burst_left;
+} tracegen_t;
+
+//Uniform in (0, 1), from splitmix64
+static double next_uniform(tracegen_t *g)
+{
+	uint64_t z = (g->rng += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return ((z >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double next_exponential(tracegen_t *g, double mean)
+{
+	return -mean * log(next_uniform(g));
+}
+
+int next_arrival(tracegen_t *g)
+{
+	if (g->arrivals == ARRIVE_POISSON)
+		g->clock += next_exponential(g, g->mean_gap);
+	else if (g->burst_left > 0)
+	{
+		g->burst_left--;
+		g->clock += next_exponential(g, g->mean_gap / 10);
+	}
+	else
+	{
+		//A burst of B jobs spans one gap and B-1 short steps, B * mean_gap on average
+		int length = 1 + (int)(log(next_uniform(g)) / log(1 - 1 / g->burst_length));
+		g->burst_left = length - 1;
+		g->clock += next_exponential(g, g->burst_length * g->mean_gap - (g->burst_length - 1) * g->mean_gap / 10);
+	}
+	return g->clock < INT_MAX / 2 ? (int)g->clock : INT_MAX / 2;
+}
+
+int next_run_time(tracegen_t *g)
+{
+	double run;
+	switch (g->runs)
+	{
+		case RUN_PARETO:
+			//Scale chosen so the mean is mean_run, which needs alpha > 1
+			run = g->mean_run * (g->alpha - 1) / g->alpha * pow(next_uniform(g), -1 / g->alpha);
+			break;
+
+		case RUN_UNIFORM:
+			run = 1 + next_uniform(g) * (2 * g->mean_run - 1);
+			break;
+
+		default:
+			run = next_exponential(g, g->mean_run);
+			break;
+	}
+	if (run < 1)
+		return 1;
+	return run < INT_MAX / 4 ? (int)run : INT_MAX / 4;
+}
+
+int next_priority(tracegen_t *g)
+{
+	switch (g->priorities)
+	{
+		case PRIORITY_ZIPF:
+		{
+			double u = next_uniform(g);
+			int low = 0, high = g->levels - 1;
+			while (low < high)
+			{
+				int mid = (low + high) / 2;
+				if (g->zipf[mid] < u)
+					low = mid + 1;
+				else
+					high = mid;
+			}
+			return low;
+		}
+
+		case PRIORITY_CONSTANT:
+			return 0;
+
+		default:
+			return (int)(next_uniform(g) * g->levels);
+	}
+}
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s -n <jobs> [-a poisson|bursty] [-g <gap>] [-B <burst>] [-r exp|pareto|uniform] [-m <mean>] [-A <alpha>]\n", program_name);
+	fprintf(stderr, "       [-p uniform|zipf|constant] [-P <levels>] [-S <seed>] [-b] [-o <file>]\n");
+	fprintf(stderr, "       %s -n 100000 -a bursty -r pareto -p zipf -b -o big.bin\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -n  number of jobs to generate\n");
+	fprintf(stderr, "  -a  arrival process (default poisson)\n");
+	fprintf(stderr, "  -g  mean time between arrivals (default 10)\n");
+	fprintf(stderr, "  -B  mean jobs per burst for -a bursty (default 20)\n");
+	fprintf(stderr, "  -r  run time distribution (default exp)\n");
+	fprintf(stderr, "  -m  mean run time (default 8)\n");
+	fprintf(stderr, "  -A  Pareto shape for -r pareto, above 1 (default 1.5)\n");
+	fprintf(stderr, "  -p  priority distribution over [0, levels) (default uniform)\n");
+	fprintf(stderr, "  -P  number of priority levels (default 10)\n");
+	fprintf(stderr, "  -S  random seed (default 1)\n");
+	fprintf(stderr, "  -b  write the binary trace format instead of CSV\n");
+	fprintf(stderr, "  -o  write to <file> instead of stdout (required with -b)\n");
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	long jobs = 0;
+	int binary = 0;
+	char *out_file = NULL;
+	tracegen_t g = { ARRIVE_POISSON, 10, 20, RUN_EXPONENTIAL, 8, 1.5, PRIORITY_UNIFORM, 10, NULL, 1, 0, 0 };
+
+	while ((c = getopt(argc, argv, "n:a:g:B:r:m:A:p:P:S:bo:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': jobs = atol(optarg); break;
+			case 'g': g.mean_gap = atof(optarg); break;
+			case 'B': g.burst_length = atof(optarg); break;
+			case 'm': g.mean_run = atof(optarg); break;
+			case 'A': g.alpha = atof(optarg); break;
+			case 'P': g.levels = atoi(optarg); break;
+			case 'S': g.rng = strtoull(optarg, NULL, 10); break;
+			case 'b': binary = 1; break;
+			case 'o': out_file = optarg; break;
+
+			case 'a':
+				if (strcasecmp(optarg, "poisson") == 0) { g.arrivals = ARRIVE_POISSON; }
+				else if (strcasecmp(optarg, "bursty") == 0) { g.arrivals = ARRIVE_BURSTY; }
+				else { print_usage(argv[0]); return 1; }
+				break;
+
+			case 'r':
+				if (strcasecmp(optarg, "exp") == 0) { g.runs = RUN_EXPONENTIAL; }
+				else if (strcasecmp(optarg, "pareto") == 0) { g.runs = RUN_PARETO; }
+				else if (strcasecmp(optarg, "uniform") == 0) { g.runs = RUN_UNIFORM; }
+				else { print_usage(argv[0]); return 1; }
+				break;
+
+			case 'p':
+				if (strcasecmp(optarg, "uniform") == 0) { g.priorities = PRIORITY_UNIFORM; }
+				else if (strcasecmp(optarg, "zipf") == 0) { g.priorities = PRIORITY_ZIPF; }
+				else if (strcasecmp(optarg, "constant") == 0) { g.priorities = PRIORITY_CONSTANT; }
+				else { print_usage(argv[0]); return 1; }
+				break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (jobs <= 0 || jobs > INT_MAX)
+	{
+		fprintf(stderr, "Required option -n <jobs> requires a positive number.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (g.mean_gap <= 0 || g.burst_length < 1 || g.mean_run < 1 || g.alpha <= 1 || g.levels <= 0)
+	{
+		fprintf(stderr, "Options -g and -m need values of at least 1 (-g above 0), -B at least 1, -A above 1 and -P above 0.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (binary && out_file == NULL)
+	{
+		fprintf(stderr, "Option -b requires -o <file>.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (g.priorities == PRIORITY_ZIPF)
+	{
+		double total = 0;
+		g.zipf = malloc(sizeof(double) * g.levels);
+		for (int i = 0; i < g.levels; i++)
+			g.zipf[i] = (total += 1.0 / (i + 1));
+		for (int i = 0; i < g.levels; i++)
+			g.zipf[i] /= total;
+	}
+
+	if (binary)
+	{
+		trace_t trace = { (int)jobs, malloc(sizeof(trace_job_t) * jobs) };
+		if (trace.jobs == NULL)
+		{
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
+		}
+		for (long i = 0; i < jobs; i++)
+		{
+			trace.jobs[i].arrival_time = next_arrival(&g);
+			trace.jobs[i].run_time = next_run_time(&g);
+			trace.jobs[i].priority = next_priority(&g);
+		}
+		if (trace_save_binary(&trace, out_file) != TRACE_OK)
+		{
+			fprintf(stderr, "Unable to write file \"%s\".\n", out_file);
+			trace_free(&trace);
+			return 2;
+		}
+		trace_free(&trace);
+	}
+	else
+	{
+		FILE *out = out_file ? fopen(out_file, "w") : stdout;
+		if (out == NULL)
+		{
+			fprintf(stderr, "Unable to write file \"%s\".\n", out_file);
+			return 2;
+		}
+		fprintf(out, "\"Arrival time\",\"Run time\",\"Priority\"\n");
+		for (long i = 0; i < jobs; i++)
+		{
+			int arrival = next_arrival(&g);
+			int run = next_run_time(&g);
+			fprintf(out, "%d,%d,%d\n", arrival, run, next_priority(&g));
+		}
+		if (fclose(out) != 0)
+		{
+			fprintf(stderr, "Unable to write file \"%s\".\n", out_file ? out_file : "stdout");
+			return 2;
+		}
+	}
+
+	free(g.zipf);
+	return 0;
+}